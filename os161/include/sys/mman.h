@@ -0,0 +1,22 @@
+#ifndef _SYS_MMAN_H_
+#define _SYS_MMAN_H_
+
+/*
+ * Get the PROT_* and MAP_* constants from the kernel
+ */
+#include <kern/mman.h>
+
+/* What mmap returns on error. */
+#define MAP_FAILED    ((void *)-1)
+
+/*
+ * mmap maps LEN bytes of the open file FILEHANDLE, starting at OFFSET
+ * (a multiple of the page size), somewhere in the address space, and
+ * returns where. ADDR is only a hint and may be ignored. munmap takes
+ * away a mapping; ADDR and LEN must be those of a whole mapping.
+ */
+void *mmap(void *addr, size_t len, int prot, int flags, int filehandle,
+	   off_t offset);
+int munmap(void *addr, size_t len);
+
+#endif /* _SYS_MMAN_H_ */
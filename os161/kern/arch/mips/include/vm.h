@@ -35,6 +35,9 @@
  */
 #define PADDR_TO_KVADDR(paddr) ((paddr)+MIPS_KSEG0)
 
+/* And back again, for addresses handed out by alloc_kpages. */
+#define KVADDR_TO_PADDR(vaddr) ((vaddr)-MIPS_KSEG0)
+
 /*
  * The top of user space. (Actually, the address immediately above the
  * last valid user address.)
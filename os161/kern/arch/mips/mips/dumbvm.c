@@ -1,10 +1,12 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <elf.h>
 #include <thread.h>
 #include <curthread.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <coremap.h>
 #include <machine/spl.h>
 #include <machine/tlb.h>
 
@@ -18,25 +20,29 @@
 /* under dumbvm, always have 48k of user stack */
 #define DUMBVM_STACKPAGES    12
 
+/*
+ * Next TLB slot to refill. Reset when the TLB is flushed, so the empty
+ * slots get used up first; after that entries are replaced round-robin.
+ */
+static u_int32_t tlb_nextslot;
+
+/*
+ * The address space whose translations are in the TLB. Others keep
+ * theirs in as_tlbhi/as_tlblo until they're switched back in.
+ */
+static struct addrspace *tlb_as;
+
 void
 vm_bootstrap(void)
 {
-	/* Do nothing. */
+	coremap_bootstrap();
 }
 
 static
 paddr_t
 getppages(unsigned long npages)
 {
-	int spl;
-	paddr_t addr;
-
-	spl = splhigh();
-
-	addr = ram_stealmem(npages);
-	
-	splx(spl);
-	return addr;
+	return coremap_alloc(npages);
 }
 
 /* Allocate/free some kernel-space virtual pages */
@@ -54,9 +60,7 @@ alloc_kpages(int npages)
 void 
 free_kpages(vaddr_t addr)
 {
-	/* nothing */
-
-	(void)addr;
+	coremap_free(KVADDR_TO_PADDR(addr));
 }
 
 int
@@ -64,10 +68,9 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 {
 	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
 	paddr_t paddr;
-	int i;
 	u_int32_t ehi, elo;
 	struct addrspace *as;
-	int spl;
+	int spl, perm;
 
 	spl = splhigh();
 
@@ -77,8 +80,9 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 
 	switch (faulttype) {
 	    case VM_FAULT_READONLY:
-		/* We always create pages read-write, so we can't get this */
-		panic("dumbvm: got VM_FAULT_READONLY\n");
+		/* Write to a read-only segment */
+		splx(spl);
+		return EFAULT;
 	    case VM_FAULT_READ:
 	    case VM_FAULT_WRITE:
 		break;
@@ -94,9 +98,12 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		 * fault early in boot. Return EFAULT so as to panic
 		 * instead of getting into an infinite faulting loop.
 		 */
+		splx(spl);
 		return EFAULT;
 	}
 
+	as->as_tlbmisses++;
+
 	/* Assert that the address space has been set up properly. */
 	assert(as->as_vbase1 != 0);
 	assert(as->as_pbase1 != 0);
@@ -120,12 +127,15 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 
 	if (faultaddress >= vbase1 && faultaddress < vtop1) {
 		paddr = (faultaddress - vbase1) + as->as_pbase1;
+		perm = as->as_perm1;
 	}
 	else if (faultaddress >= vbase2 && faultaddress < vtop2) {
 		paddr = (faultaddress - vbase2) + as->as_pbase2;
+		perm = as->as_perm2;
 	}
 	else if (faultaddress >= stackbase && faultaddress < stacktop) {
 		paddr = (faultaddress - stackbase) + as->as_stackpbase;
+		perm = PF_R | PF_W;
 	}
 	else {
 		splx(spl);
@@ -135,22 +145,22 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	/* make sure it's page-aligned */
 	assert((paddr & PAGE_FRAME)==paddr);
 
-	for (i=0; i<NUM_TLB; i++) {
-		TLB_Read(&ehi, &elo, i);
-		if (elo & TLBLO_VALID) {
-			continue;
-		}
-		ehi = faultaddress;
-		elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-		DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
-		TLB_Write(ehi, elo, i);
-		splx(spl);
-		return 0;
+	/* The loader may write anywhere; the program may not. */
+	if (as->as_loading) {
+		perm |= PF_W;
 	}
 
-	kprintf("dumbvm: Ran out of TLB entries - cannot handle page fault\n");
+	ehi = faultaddress;
+	elo = paddr | TLBLO_VALID;
+	if (perm & PF_W) {
+		elo |= TLBLO_DIRTY;
+	}
+	DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
+	TLB_Write(ehi, elo, tlb_nextslot);
+	tlb_nextslot = (tlb_nextslot + 1) % NUM_TLB;
+
 	splx(spl);
-	return EFAULT;
+	return 0;
 }
 
 struct addrspace *
@@ -168,6 +178,11 @@ as_create(void)
 	as->as_pbase2 = 0;
 	as->as_npages2 = 0;
 	as->as_stackpbase = 0;
+	as->as_perm1 = 0;
+	as->as_perm2 = 0;
+	as->as_loading = 0;
+	as->as_tlbmisses = 0;
+	as->as_ntlb = 0;
 
 	return as;
 }
@@ -175,21 +190,72 @@ as_create(void)
 void
 as_destroy(struct addrspace *as)
 {
+	int i, spl;
+
+	/* Don't let a new address space at this address inherit the TLB. */
+	spl = splhigh();
+	if (as == tlb_as) {
+		for (i=0; i<NUM_TLB; i++) {
+			TLB_Write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
+		tlb_nextslot = 0;
+		tlb_as = NULL;
+	}
+	splx(spl);
+
+	if (as->as_pbase1 != 0) {
+		coremap_free(as->as_pbase1);
+	}
+	if (as->as_pbase2 != 0) {
+		coremap_free(as->as_pbase2);
+	}
+	if (as->as_stackpbase != 0) {
+		coremap_free(as->as_stackpbase);
+	}
+	DEBUG(DB_VM, "dumbvm: %u TLB misses\n", as->as_tlbmisses);
 	kfree(as);
 }
 
 void
 as_activate(struct addrspace *as)
 {
-	int i, spl;
-
-	(void)as;
+	u_int32_t ehi, elo;
+	int i, n, spl;
 
 	spl = splhigh();
 
+	if (as == tlb_as) {
+		/* Nothing to do; the TLB is still valid. */
+		splx(spl);
+		return;
+	}
+
+	/* Save the outgoing address space's translations... */
+	if (tlb_as != NULL) {
+		n = 0;
+		for (i=0; i<NUM_TLB; i++) {
+			TLB_Read(&ehi, &elo, i);
+			if (elo & TLBLO_VALID) {
+				tlb_as->as_tlbhi[n] = ehi;
+				tlb_as->as_tlblo[n] = elo;
+				n++;
+			}
+		}
+		tlb_as->as_ntlb = n;
+	}
+
+	/* ...and bring back the incoming one's. */
+	n = (as != NULL) ? as->as_ntlb : 0;
 	for (i=0; i<NUM_TLB; i++) {
-		TLB_Write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		if (i < n) {
+			TLB_Write(as->as_tlbhi[i], as->as_tlblo[i], i);
+		}
+		else {
+			TLB_Write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
 	}
+	tlb_nextslot = n % NUM_TLB;
+	tlb_as = as;
 
 	splx(spl);
 }
@@ -199,6 +265,7 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 		 int readable, int writeable, int executable)
 {
 	size_t npages; 
+	int perm;
 
 	/* Align the region. First, the base... */
 	sz += vaddr & ~(vaddr_t)PAGE_FRAME;
@@ -209,20 +276,20 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 
 	npages = sz / PAGE_SIZE;
 
-	/* We don't use these - all pages are read-write */
-	(void)readable;
-	(void)writeable;
-	(void)executable;
+	perm = (readable ? PF_R : 0) | (writeable ? PF_W : 0) |
+		(executable ? PF_X : 0);
 
 	if (as->as_vbase1 == 0) {
 		as->as_vbase1 = vaddr;
 		as->as_npages1 = npages;
+		as->as_perm1 = perm;
 		return 0;
 	}
 
 	if (as->as_vbase2 == 0) {
 		as->as_vbase2 = vaddr;
 		as->as_npages2 = npages;
+		as->as_perm2 = perm;
 		return 0;
 	}
 
@@ -255,13 +322,28 @@ as_prepare_load(struct addrspace *as)
 		return ENOMEM;
 	}
 
+	as->as_loading = 1;
 	return 0;
 }
 
 int
 as_complete_load(struct addrspace *as)
 {
-	(void)as;
+	int i, spl;
+
+	as->as_loading = 0;
+
+	/* Get rid of writeable mappings of read-only pages. */
+	spl = splhigh();
+	if (as == tlb_as) {
+		for (i=0; i<NUM_TLB; i++) {
+			TLB_Write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
+		tlb_nextslot = 0;
+	}
+	as->as_ntlb = 0;
+	splx(spl);
+
 	return 0;
 }
 
@@ -289,11 +371,14 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	new->as_npages1 = old->as_npages1;
 	new->as_vbase2 = old->as_vbase2;
 	new->as_npages2 = old->as_npages2;
+	new->as_perm1 = old->as_perm1;
+	new->as_perm2 = old->as_perm2;
 
 	if (as_prepare_load(new)) {
 		as_destroy(new);
 		return ENOMEM;
 	}
+	new->as_loading = 0;
 
 	assert(new->as_pbase1 != 0);
 	assert(new->as_pbase2 != 0);
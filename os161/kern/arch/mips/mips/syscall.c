@@ -57,6 +57,7 @@ mips_syscall(struct trapframe *tf)
 	// kprintf("%d %d %d %d", tf->tf_v0 == tf_copy->tf_v0, tf->tf_a3 == tf_copy->tf_a3, tf->tf_a0 == tf_copy->tf_a0, tf->tf_epc == tf_copy->tf_epc);
 	int callno;
 	int32_t retval;
+	int32_t stackargs[2];
 	int err = 0;
 	assert(curspl==0);
 	callno = tf->tf_v0;
@@ -80,21 +81,30 @@ mips_syscall(struct trapframe *tf)
 	    /* Add stuff here */      
 		case SYS_write:
 			err = sys_write(tf->tf_a0, (void *) tf->tf_a1, tf->tf_a2, &retval);
-			// kprintf("ERR under sys write: %d\n", err);
-			if(err != 0){
-				retval = -1;
-			}
 			break;
 
 		case SYS_read:
-			err = sys_read(tf->tf_a0, (void *) tf->tf_a1, tf->tf_a2);
-			if(err == 0){
-				retval = 1;
-			}
-			else if(err != 0){
-				retval = -1;
-			}
-			// kprintf("err under sys read: %d\n", err);
+			err = sys_read(tf->tf_a0, (void *) tf->tf_a1, tf->tf_a2, &retval);
+			break;
+
+		case SYS_open:
+			err = sys_open((const char *) tf->tf_a0, tf->tf_a1, &retval);
+			break;
+
+		case SYS_close:
+			err = sys_close(tf->tf_a0);
+			break;
+
+		case SYS_lseek:
+			err = sys_lseek(tf->tf_a0, tf->tf_a1, tf->tf_a2, &retval);
+			break;
+
+		case SYS_dup2:
+			err = sys_dup2(tf->tf_a0, tf->tf_a1, &retval);
+			break;
+
+		case SYS_fsync:
+			err = sys_fsync(tf->tf_a0);
 			break;
 
 		case SYS___time:
@@ -129,6 +139,26 @@ mips_syscall(struct trapframe *tf)
 			retval = sys_execv((char *) tf->tf_a0, (char **) tf->tf_a1, &err);
 			break;
 
+		case SYS_sbrk:
+			err = sys_sbrk((intptr_t) tf->tf_a0, &retval);
+			break;
+
+		case SYS_mmap:
+			/* The fifth and sixth arguments are on the stack. */
+			err = copyin((const_userptr_t) (tf->tf_sp + 16),
+				     stackargs, sizeof(stackargs));
+			if (err == 0) {
+				err = sys_mmap((void *) tf->tf_a0, tf->tf_a1,
+					       tf->tf_a2, tf->tf_a3,
+					       stackargs[0], stackargs[1],
+					       &retval);
+			}
+			break;
+
+		case SYS_munmap:
+			err = sys_munmap((void *) tf->tf_a0, tf->tf_a1);
+			break;
+
 
 	    default:
 		kprintf("Unknown syscall %d\n", callno);
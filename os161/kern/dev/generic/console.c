@@ -19,6 +19,11 @@
  *
  * Note that we have no input buffering; characters typed too rapidly
  * will be lost.
+ *
+ * Output, on the other hand, is buffered: see console.h. User writes
+ * are copied in a chunk at a time and queued on the output ring, so a
+ * large write uses a fixed amount of kernel memory and raises spl once
+ * per chunk rather than waiting for an interrupt on every character.
  */
 
 #include <types.h>
@@ -26,6 +31,7 @@
 #include <lib.h>
 #include <machine/spl.h>
 #include <synch.h>
+#include <thread.h>
 #include <generic/console.h>
 #include <dev.h>
 #include <vfs.h>
@@ -81,29 +87,87 @@ flush_delay_buf(void)
 
 //////////////////////////////////////////////////
 
+/*
+ * Take the next character off the output ring.
+ */
+static
+int
+con_odequeue(struct con_softc *cs)
+{
+	int ch;
+
+	assert(curspl>0);
+	assert(cs->cs_olen > 0);
+
+	ch = cs->cs_obuf[cs->cs_ohead];
+	cs->cs_ohead = (cs->cs_ohead + 1) % CON_OBUFSIZE;
+	cs->cs_olen--;
+	return ch;
+}
+
+/*
+ * Wake up writers waiting for room, once the ring has drained to half
+ * full.
+ */
+static
+void
+con_owakeup(struct con_softc *cs)
+{
+	if (cs->cs_owaiting && cs->cs_olen <= CON_OBUFSIZE/2) {
+		cs->cs_owaiting = 0;
+		thread_wakeup(cs->cs_obuf);
+	}
+}
+
+//////////////////////////////////////////////////
+
 /*
  * Print a character, using polling instead of interrupts to wait for
- * I/O completion.
+ * I/O completion. Anything still on the output ring goes out first,
+ * so output appears in the order it was printed.
  */
 static
 void
 putch_polled(struct con_softc *cs, int ch)
 {
+	while (cs->cs_olen > 0) {
+		cs->cs_sendpolled(cs->cs_devdata, con_odequeue(cs));
+	}
+	con_owakeup(cs);
 	cs->cs_sendpolled(cs->cs_devdata, ch);
 }
 
 //////////////////////////////////////////////////
 
 /*
- * Print a character, using interrupts to wait for I/O completion.
+ * Print LEN characters, using interrupts to wait for I/O completion.
+ * They're queued on the output ring, and the device is started if
+ * it's idle; the write-done interrupt sends the rest. Sleeps if the
+ * ring fills up.
  */
 
 static
 void
-putch_intr(struct con_softc *cs, int ch)
+putbuf_intr(struct con_softc *cs, const char *buf, size_t len)
 {
-	P(cs->cs_wsem);
-	cs->cs_send(cs->cs_devdata, ch);
+	size_t i;
+	int spl;
+
+	spl = splhigh();
+	for (i=0; i<len; i++) {
+		while (cs->cs_olen == CON_OBUFSIZE) {
+			cs->cs_owaiting = 1;
+			thread_sleep(cs->cs_obuf);
+		}
+		cs->cs_obuf[(cs->cs_ohead + cs->cs_olen) % CON_OBUFSIZE] =
+			buf[i];
+		cs->cs_olen++;
+		if (!cs->cs_obusy) {
+			cs->cs_obusy = 1;
+			cs->cs_send(cs->cs_devdata, con_odequeue(cs));
+		}
+	}
+	splx(spl);
 }
 
 /*
@@ -132,13 +196,20 @@ con_input(void *vcs, int ch)
 
 /*
  * Called from underlying device when a write-done interrupt occurs.
+ * Sends the next character on the output ring, if there is one.
  */
 void
 con_start(void *vcs)
 {
 	struct con_softc *cs = vcs;
 
-	V(cs->cs_wsem);
+	if (cs->cs_olen > 0) {
+		cs->cs_send(cs->cs_devdata, con_odequeue(cs));
+	}
+	else {
+		cs->cs_obusy = 0;
+	}
+	con_owakeup(cs);
 }
 
 //////////////////////////////////////////////////
@@ -155,6 +226,7 @@ void
 putch(int ch)
 {
 	struct con_softc *cs = the_console;
+	char c = ch;
 
 	if (cs==NULL) {
 		putch_delayed(ch);
@@ -163,7 +235,7 @@ putch(int ch)
 		putch_polled(cs, ch);
 	}
 	else {
-		putch_intr(cs, ch);
+		putbuf_intr(cs, &c, 1);
 	}
 }
 
@@ -200,16 +272,22 @@ con_close(struct device *dev)
 	return 0;
 }
 
+/*
+ * User writes are copied in this many bytes at a time.
+ */
+#define CON_CHUNK  64
+
 static
 int
 con_io(struct device *dev, struct uio *uio)
 {
+	struct con_softc *cs = dev->d_data;
 	int result;
 	char ch;
+	char inbuf[CON_CHUNK], outbuf[2*CON_CHUNK];
+	size_t i, len, outlen;
 	struct lock *lk;
 
-	(void)dev;  // unused
-
 	if (uio->uio_rw==UIO_READ) {
 		lk = con_userlock_read;
 	}
@@ -236,15 +314,30 @@ con_io(struct device *dev, struct uio *uio)
 			}
 		}
 		else {
-			result = uiomove(&ch, 1, uio);
+			len = uio->uio_resid;
+			if (len > CON_CHUNK) {
+				len = CON_CHUNK;
+			}
+			result = uiomove(inbuf, len, uio);
 			if (result) {
 				lock_release(lk);
 				return result;
 			}
-			if (ch=='\n') {
-				putch('\r');
+			outlen = 0;
+			for (i=0; i<len; i++) {
+				if (inbuf[i]=='\n') {
+					outbuf[outlen++] = '\r';
+				}
+				outbuf[outlen++] = inbuf[i];
+			}
+			if (in_interrupt || curspl>0) {
+				for (i=0; i<outlen; i++) {
+					putch_polled(cs, outbuf[i]);
+				}
+			}
+			else {
+				putbuf_intr(cs, outbuf, outlen);
 			}
-			putch(ch);
 		}
 	}
 	lock_release(lk);
@@ -300,7 +393,7 @@ attach_console_to_vfs(struct con_softc *cs)
 int
 config_con(struct con_softc *cs, int unit)
 {
-	struct semaphore *rsem, *wsem;
+	struct semaphore *rsem;
 	struct lock *rlk, *wlk;
 
 	/*
@@ -320,28 +413,24 @@ config_con(struct con_softc *cs, int unit)
 	if (rsem == NULL) {
 		return ENOMEM;
 	}
-	wsem = sem_create("console write", 1);
-	if (wsem == NULL) {
-		sem_destroy(rsem);
-		return ENOMEM;
-	}
 	rlk = lock_create("console-lock-read");
 	if (rlk == NULL) {
 		sem_destroy(rsem);
-		sem_destroy(wsem);
 		return ENOMEM;
 	}
 	wlk = lock_create("console-lock-write");
 	if (wlk == NULL) {
 		lock_destroy(rlk);
 		sem_destroy(rsem);
-		sem_destroy(wsem);
 		return ENOMEM;
 	}
 
 	cs->cs_rsem = rsem; 
-	cs->cs_wsem = wsem; 
 	cs->cs_gotchar = 0;
+	cs->cs_ohead = 0;
+	cs->cs_olen = 0;
+	cs->cs_obusy = 0;
+	cs->cs_owaiting = 0;
 
 	the_console = cs;
 	con_userlock_read = rlk;
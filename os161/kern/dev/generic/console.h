@@ -6,8 +6,16 @@
  *
  * devdata, send, and sendpolled are provided by the underlying
  * device, and are to be initialized by the attach routine.
+ *
+ * Output written with interrupts on goes through a ring buffer. The
+ * write-done interrupt sends the next character straight out of the
+ * ring, so the device keeps busy without any thread having to run,
+ * and writers only sleep when the ring is full. They are woken once it
+ * has drained to half full, rather than once per character.
  */
 
+#define CON_OBUFSIZE  1024
+
 struct con_softc {
 	/* initialized by attach routine */
 	void *cs_devdata;
@@ -16,8 +24,14 @@ struct con_softc {
 
 	/* initialized by config routine */
 	struct semaphore *cs_rsem;
-	struct semaphore *cs_wsem;
 	int cs_gotchar;
+
+	/* output ring; synchronized with spl */
+	char cs_obuf[CON_OBUFSIZE];
+	unsigned cs_ohead;		/* next character to send */
+	unsigned cs_olen;		/* characters waiting to be sent */
+	volatile int cs_obusy;		/* device is sending one of them */
+	int cs_owaiting;		/* writers asleep until there's room */
 };
 
 /*
@@ -1047,14 +1047,15 @@ sfs_fsync(struct vnode *v)
 }
 
 /*
- * Called for mmap().
+ * Called for mmap(). The VM system pages the file in and out through
+ * sfs_read and sfs_write, so any regular file can be mapped.
  */
 static
 int
-sfs_mmap(struct vnode *v   /* add stuff as needed */)
+sfs_mmap(struct vnode *v)
 {
 	(void)v;
-	return EUNIMP;
+	return 0;
 }
 
 /*
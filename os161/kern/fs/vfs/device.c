@@ -203,15 +203,16 @@ null_fsync(struct vnode *v)
 }
 
 /*
- * For mmap. If you want this to do anything, you have to write it
- * yourself. Some devices may not make sense to map. Others do.
+ * For mmap. None of our devices have memory that makes sense to map,
+ * and the VM system's page-sized reads and writes at arbitrary offsets
+ * don't suit most of them either.
  */
 static
 int
-dev_mmap(struct vnode *v  /* add stuff as needed */)
+dev_mmap(struct vnode *v)
 {
 	(void)v;
-	return EUNIMP;
+	return ENODEV;
 }
 
 /*
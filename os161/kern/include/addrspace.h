@@ -2,8 +2,38 @@
 #define _ADDRSPACE_H_
 
 #include <vm.h>
+#include <machine/tlb.h>
 
 struct vnode;
+struct pagetable;
+struct vmobj;
+
+#if !OPT_DUMBVM
+/*
+ * A region is a page-aligned range of user addresses that may be
+ * touched. Pages in a region are only given memory when first used:
+ * zero-filled, or if the region is backed by a file, shared with
+ * everyone else using that part of the file. Writes to a file-backed
+ * region make a private copy of the page, unless the region was mapped
+ * with MAP_SHARED.
+ */
+struct region {
+	vaddr_t rg_vbase;
+	size_t rg_npages;
+	int rg_perm;		/* PF_R, PF_W and PF_X, from elf.h */
+	struct vmobj *rg_obj;	/* file the pages come from, or NULL */
+	off_t rg_objoff;	/* file offset of rg_vbase */
+	size_t rg_filesz;	/* bytes from the file; the rest is zero */
+	int rg_mapflags;	/* MAP_SHARED or MAP_PRIVATE if mmapped */
+};
+
+/*
+ * The user stack starts out one page long and grows down as it's
+ * used, up to the process's stack limit. This much address space
+ * below USERSTACK is kept free for it.
+ */
+#define VM_STACKLIMIT    (1024*1024)
+#endif
 
 /* 
  * Address space - data structure associated with the virtual memory
@@ -21,16 +51,25 @@ struct addrspace {
 	paddr_t as_pbase2;
 	size_t as_npages2;
 	paddr_t as_stackpbase;
+	int as_perm1;		/* PF_* permissions of the two regions */
+	int as_perm2;
 #else
-	vaddr_t as_vbase1;
-	paddr_t as_pbase1;
-	size_t as_npages1;
-	vaddr_t as_vbase2;
-	paddr_t as_pbase2;
-	size_t as_npages2;
-	paddr_t as_stackpbase;
-	/* Put stuff here for your VM system */
+	struct region *as_regions;	/* sorted by address */
+	int as_nregions;
+	int as_maxregions;		/* size of as_regions[] */
+	struct region as_stack;
+	size_t as_stacklimit;		/* max stack size, in bytes */
+	struct region as_heap;		/* starts after the last segment */
+	vaddr_t as_heapend;		/* the break */
+	struct pagetable *as_pt;
 #endif
+	int as_loading;		/* between as_prepare/complete_load */
+	u_int32_t as_tlbmisses;	/* TLB refills, for profiling */
+
+	/* TLB contents, saved while another address space is active */
+	u_int32_t as_tlbhi[NUM_TLB];
+	u_int32_t as_tlblo[NUM_TLB];
+	int as_ntlb;
 };
 
 /*
@@ -54,7 +93,10 @@ struct addrspace {
  *                the way this works if implementing user-level threads.
  *
  *    as_define_region - set up a region of memory within the address
- *                space.
+ *                space. Writes are only allowed to writeable regions,
+ *                except while loading. In the paging VM, there can be
+ *                any number of regions; segments that share a page
+ *                are merged into one region.
  *
  *    as_prepare_load - this is called before actually loading from an
  *                executable into the address space.
@@ -82,6 +124,54 @@ int		  as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
 int		  as_equals(struct addrspace *as1, struct addrspace *as2);
 
+#if !OPT_DUMBVM
+/*
+ *    as_define_file - like as_define_region, but the first FILESZ
+ *                bytes of the region come from V starting at OFFSET,
+ *                and the rest are zero. Pages are read on first touch,
+ *                and shared with every other address space mapping
+ *                the same file. A write makes a private copy of the
+ *                page. VADDR and OFFSET must be the same modulo
+ *                PAGE_SIZE.
+ *
+ *    as_getregion - return the region containing VADDR, or NULL if the
+ *                address isn't part of the address space. Takes
+ *                O(log n) in the number of regions. The pointer is
+ *                only good until the next region is defined.
+ *
+ *    as_growstack - if VADDR is below the stack but within the stack
+ *                limit, extend the stack down to cover it and return
+ *                the stack region. Otherwise return NULL.
+ *
+ *    as_sbrk   - move the end of the heap by CHANGE bytes, handing back
+ *                the old end in OLDBREAK. Pages freed by shrinking the
+ *                heap are discarded. Returns EINVAL if the heap would
+ *                end before it starts, and ENOMEM if it would run into
+ *                another region or the stack.
+ *
+ *    as_mmap   - map SZ bytes of V, starting at page-aligned OFFSET,
+ *                between the heap and the stack, with PROT and FLAGS as
+ *                for mmap. Hands back the address chosen.
+ *
+ *    as_munmap - remove the mapping made by as_mmap at VADDR. SZ must
+ *                cover the whole mapping.
+ */
+int               as_define_file(struct addrspace *as,
+				 vaddr_t vaddr, size_t sz,
+				 struct vnode *v, off_t offset, size_t filesz,
+				 int readable,
+				 int writeable,
+				 int executable);
+struct region    *as_getregion(struct addrspace *as, vaddr_t vaddr);
+struct region    *as_growstack(struct addrspace *as, vaddr_t vaddr);
+int               as_sbrk(struct addrspace *as, intptr_t change,
+			  vaddr_t *oldbreak);
+int               as_mmap(struct addrspace *as, size_t sz,
+			  struct vnode *v, off_t offset,
+			  int prot, int flags, vaddr_t *ret);
+int               as_munmap(struct addrspace *as, vaddr_t vaddr, size_t sz);
+#endif
+
 /*
  * Functions in loadelf.c
  *    load_elf - load an ELF user program executable into the current
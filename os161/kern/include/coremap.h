@@ -0,0 +1,100 @@
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+/*
+ * Physical page allocator.
+ *
+ * The coremap has one entry for every physical page handed to the VM
+ * system by ram_getsize(). Free pages are kept on a doubly linked
+ * free list, so allocating or freeing a single page is O(1). Requests
+ * for more than one page (large kmallocs) search the coremap for a
+ * run of free pages, since those have to be physically contiguous.
+ *
+ * Each allocated block has a reference count, which starts at 1. User
+ * pages shared between address spaces are freed only when the last
+ * address space lets go of them.
+ *
+ * A user page that belongs to exactly one address space can be given
+ * an owner, recording where it is mapped, so the page-out daemon can
+ * find its PTE and push it out to swap. Shared pages have no owner and
+ * are never paged out.
+ *
+ * Which owned page gets paged out is up to the replacement policy,
+ * selectable at runtime: "fifo", "clock" (second chance; the default),
+ * or "aging" (approximate LRU).
+ *
+ * Fresh anonymous user pages have to be zero. To keep that off the
+ * fault path, a kernel thread zeroes free pages whenever the CPU would
+ * otherwise be idle, and keeps a small pool of them on the free list.
+ *
+ * Functions:
+ *     coremap_bootstrap  - take over physical memory from ram.c. Until
+ *                          this is called, pages come from ram_stealmem
+ *                          and can never be freed.
+ *     coremap_alloc      - allocate NPAGES physically contiguous pages.
+ *                          If memory is short, may sleep waiting for the
+ *                          page-out daemon. Returns 0 if not enough
+ *                          memory is available.
+ *     coremap_alloczero  - allocate one zero-filled page, from the pool
+ *                          if there's one there, zeroing it otherwise.
+ *     coremap_free       - drop a reference to the block of pages
+ *                          starting at PADDR, freeing it when the last
+ *                          reference goes away. PADDR must have come
+ *                          from coremap_alloc. Pages stolen before
+ *                          bootstrap are ignored.
+ *     coremap_incref     - add a reference to the single page PADDR,
+ *                          e.g. when it is shared copy-on-write. The
+ *                          page loses its owner.
+ *     coremap_refcount   - return the number of references to PADDR.
+ *     coremap_setowner   - record that user page PADDR is mapped at
+ *                          VADDR in AS. Ignored if the page is shared.
+ *     coremap_touch      - note that PADDR is being mapped, for writing
+ *                          if WRITE is set. Returns nonzero if the page
+ *                          is dirty and may be mapped writeable.
+ *     coremap_setslot    - record that PADDR was just read from swap
+ *                          slot SLOT, and is therefore clean.
+ *     coremap_victim     - pick an owned page to evict, mark it busy,
+ *                          and return it and its owner. If the page is
+ *                          clean, also hands back the swap slot that
+ *                          already holds it; otherwise SWAP_NOSLOT.
+ *                          Returns 0 if there is no page to evict.
+ *                          Interrupts must be off.
+ *     coremap_unbusy     - give up on evicting PADDR.
+ *     coremap_setpolicy  - choose a replacement policy by name. Returns
+ *                          EINVAL if there's no such policy.
+ *     coremap_getpolicy  - return the name of the Nth policy, or NULL
+ *                          past the end; if N is negative, the name of
+ *                          the one in use.
+ *     coremap_zerobootstrap - start the page-zeroing thread.
+ *     coremap_idle       - called by the scheduler when there's nothing
+ *                          to run. Returns nonzero if it has made the
+ *                          page-zeroing thread runnable. Interrupts must
+ *                          be off.
+ *     coremap_freepages  - return the number of free pages.
+ *     coremap_printstats - print page usage to the console.
+ *
+ * Except as noted, these may be called with interrupts on or off.
+ */
+
+struct addrspace;
+
+void     coremap_bootstrap(void);
+paddr_t  coremap_alloc(unsigned long npages);
+paddr_t  coremap_alloczero(void);
+void     coremap_free(paddr_t paddr);
+void     coremap_incref(paddr_t paddr);
+unsigned coremap_refcount(paddr_t paddr);
+void     coremap_setowner(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+int      coremap_touch(paddr_t paddr, int write);
+void     coremap_setslot(paddr_t paddr, u_int32_t slot);
+paddr_t  coremap_victim(struct addrspace **as, vaddr_t *vaddr,
+			u_int32_t *slot);
+void     coremap_unbusy(paddr_t paddr);
+int      coremap_setpolicy(const char *name);
+const char *coremap_getpolicy(int n);
+void     coremap_zerobootstrap(void);
+int      coremap_idle(void);
+unsigned coremap_freepages(void);
+void     coremap_printstats(void);
+
+#endif /* _COREMAP_H_ */
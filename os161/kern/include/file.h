@@ -0,0 +1,68 @@
+#ifndef _FILE_H_
+#define _FILE_H_
+
+/*
+ * Open files and file descriptor tables.
+ *
+ * An open file is what open() makes: a vnode, the flags it was opened
+ * with, and a seek position. A file descriptor names an open file
+ * through a file table. Several descriptors can name the same open
+ * file, either through dup2 or because fork copies the file table;
+ * they then share the seek position, so a read in one process moves
+ * the offset seen by the other. Each open file counts the descriptors
+ * naming it and is closed when the last of them goes away. Its lock
+ * keeps reads, writes and seeks through it from overlapping.
+ *
+ * Every thread running a user program has a file table (t_filetable),
+ * set up by runprogram with the console on descriptors 0, 1 and 2,
+ * copied by fork, and kept across execv. Kernel threads have none.
+ *
+ * Functions:
+ *     filetable_create  - return a new, empty file table, or NULL.
+ *     filetable_copy    - make a copy of file table FT that shares its
+ *                         open files. Returns an error code.
+ *     filetable_destroy - close every descriptor in FT and free it.
+ *     filetable_openstd - open the console on descriptors 0, 1 and 2.
+ *     file_open         - open PATH with open() flags FLAGS on the
+ *                         lowest free descriptor, and hand it back.
+ *                         May destroy PATH, as vfs_open does. Returns
+ *                         EMFILE if every descriptor is in use.
+ *     file_close        - close descriptor FD.
+ *     file_get          - hand back the open file descriptor FD names,
+ *                         or return EBADF. The open file stays valid
+ *                         until this process closes FD.
+ *     file_dup2         - make NEWFD name the same open file as OLDFD,
+ *                         closing whatever NEWFD named first.
+ *
+ * These may sleep, and must be called with interrupts on.
+ */
+
+#include <kern/limits.h>
+
+struct vnode;
+struct lock;
+
+struct openfile {
+	struct vnode *of_vnode;
+	int of_flags;			/* as passed to open() */
+	off_t of_offset;		/* seek position; under of_lock */
+	unsigned of_refcount;		/* descriptors naming this file */
+	struct lock *of_lock;
+};
+
+struct filetable {
+	struct openfile *ft_files[OPEN_MAX];
+};
+
+struct filetable *filetable_create(void);
+int               filetable_copy(struct filetable *ft,
+                                 struct filetable **ret);
+void              filetable_destroy(struct filetable *ft);
+int               filetable_openstd(struct filetable *ft);
+
+int file_open(struct filetable *ft, char *path, int flags, int *retfd);
+int file_close(struct filetable *ft, int fd);
+int file_get(struct filetable *ft, int fd, struct openfile **ret);
+int file_dup2(struct filetable *ft, int oldfd, int newfd);
+
+#endif /* _FILE_H_ */
@@ -41,6 +41,8 @@
 #define SYS_stat         30
 #define SYS_lstat        31
 #define SYS_sleep        32
+#define SYS_mmap         33
+#define SYS_munmap       34
 /*CALLEND*/
 
 
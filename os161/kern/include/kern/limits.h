@@ -7,5 +7,12 @@
 /* Longest full path name */
 #define PATH_MAX   1024
 
+/* Range of process ids */
+#define PID_MIN    1
+#define PID_MAX    32767
+
+/* Open files per process */
+#define OPEN_MAX   64
+
 
 #endif /* _KERN_LIMITS_H_ */
@@ -0,0 +1,21 @@
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Constants for mmap
+ */
+
+/*
+ * Protections: or together any of these. PROT_WRITE needs PROT_READ
+ * too, and PROT_EXEC pages can also be read.
+ */
+#define PROT_NONE     0      /* Pages may not be accessed */
+#define PROT_READ     1      /* Pages may be read */
+#define PROT_WRITE    2      /* Pages may be written */
+#define PROT_EXEC     4      /* Pages may be executed */
+
+/* Flags: choose one of these. */
+#define MAP_SHARED    1      /* Writes go to the file */
+#define MAP_PRIVATE   2      /* Writes make a private copy */
+
+#endif /* _KERN_MMAN_H_ */
@@ -7,6 +7,7 @@
  */
 
 #include <machine/setjmp.h>
+#include "opt-kmalloctrace.h"
 
 /*
  * Tell GCC to check printf formats.
@@ -91,6 +92,25 @@ void *kmalloc(size_t sz);
 void kfree(void *ptr);
 void kheap_printstats(void);
 
+#if OPT_KMALLOCTRACE
+/*
+ * With the kmalloctrace option, every kmalloc records the file and
+ * line it was called from, and the allocation stays on record until
+ * it is freed.
+ *
+ * kheap_tracereport prints the callsites that have allocated the most
+ * memory, or that hold the most now if BYLIVE is set. kheap_tracemark
+ * starts a new leak check; kheap_leakreport lists every allocation
+ * made since the mark that hasn't been freed yet.
+ */
+void *kmalloc_traced(size_t sz, const char *file, int line);
+void kheap_tracereport(int bylive);
+void kheap_tracemark(void);
+void kheap_leakreport(void);
+
+#define kmalloc(sz) kmalloc_traced(sz, __FILE__, __LINE__)
+#endif
+
 /*
  * C string functions. 
  *
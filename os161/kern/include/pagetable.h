@@ -0,0 +1,58 @@
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+#include <vm.h>
+
+/*
+ * Two-level page table for a user address space.
+ *
+ * The directory has one slot for each 4M of user address space. Each
+ * slot points to a page of PTEs, which is allocated the first time
+ * something in that 4M is mapped. A PTE is one word: the physical
+ * page address in the high bits and flags in the low bits. A PTE of
+ * zero means the page has never been touched. A page that has been
+ * paged out keeps its swap slot number in the high bits instead.
+ *
+ * PTE_BUSY is set while a page is moving to or from swap. Anyone else
+ * who needs the PTE sleeps on its address until the bit is cleared.
+ *
+ * Functions:
+ *     pt_create  - allocate an empty page table. Returns NULL if out
+ *                  of memory.
+ *     pt_destroy - free the page table itself. Whatever the PTEs
+ *                  refer to must already have been released.
+ *     pt_lookup  - return a pointer to the PTE for VADDR. If the page
+ *                  of PTEs covering VADDR doesn't exist yet, creates it
+ *                  if CREATE is set and returns NULL otherwise. Also
+ *                  returns NULL if out of memory.
+ *     pt_foreach - call FUNC on every nonzero PTE, in increasing
+ *                  address order. Stops early and returns FUNC's
+ *                  result if FUNC returns nonzero.
+ */
+
+typedef u_int32_t pte_t;
+
+#define PTE_VALID        0x00000001	/* page is resident */
+#define PTE_SWAPPED      0x00000002	/* page is in swap */
+#define PTE_BUSY         0x00000004	/* page is being swapped in/out */
+
+#define PTE_PADDR(pte)   ((pte) & PAGE_FRAME)
+#define PTE_SLOT(pte)    ((pte) >> 12)
+#define PTE_MKSWAP(slot) (((slot) << 12) | PTE_SWAPPED)
+
+#define PT_DIRSHIFT      22
+#define PT_NDIR          (USERTOP >> PT_DIRSHIFT)
+#define PT_NPTES         (PAGE_SIZE / sizeof(pte_t))
+
+struct pagetable {
+	pte_t *pt_dir[PT_NDIR];
+};
+
+struct pagetable *pt_create(void);
+void              pt_destroy(struct pagetable *pt);
+pte_t            *pt_lookup(struct pagetable *pt, vaddr_t vaddr, int create);
+int               pt_foreach(struct pagetable *pt,
+			     int (*func)(vaddr_t vaddr, pte_t *pte, void *data),
+			     void *data);
+
+#endif /* _PAGETABLE_H_ */
@@ -0,0 +1,78 @@
+#ifndef _PROC_H_
+#define _PROC_H_
+
+/*
+ * Processes.
+ *
+ * Every thread belongs to a process, which holds what outlives the
+ * thread: its pid, its place in the process tree, and, once it has
+ * exited, its exit code. A process that has exited but hasn't been
+ * waited for yet is a zombie; the zombie is the exit code slot, so
+ * there's nothing to search for when the parent waits.
+ *
+ * Processes are found by pid through a table indexed by pid. Each
+ * process also keeps two lists of its children, those still running
+ * and the zombies, so waiting for any child is as quick as waiting
+ * for a particular one. A waiting parent sleeps on its own process,
+ * and its children wake it when they exit.
+ *
+ * When a process exits, its zombie children are freed, since nobody
+ * can wait for them now. Its live children are handed to the kernel
+ * process (pid 1, the one the menu runs in), which plays the part of
+ * init. Like init, it lets its adopted children go as soon as they
+ * exit. So do processes created detached (kernel threads that no one
+ * will ever join), which are freed on exit straight away.
+ *
+ * Functions:
+ *     proc_bootstrap  - create the kernel process for the first thread.
+ *     proc_create     - create a process for thread T, as a child of
+ *                       the current process, and give it a pid. If
+ *                       DETACHED is set, no one will wait for it.
+ *                       Returns an error code.
+ *     proc_destroy    - throw away a process that never ran.
+ *     proc_exit       - record that process P has exited with EXITCODE.
+ *                       Frees P if no one is going to wait for it.
+ *     proc_wait       - wait for the child with pid PID of the current
+ *                       process, or any child if PID is -1, to exit.
+ *                       Hands back its pid and exit code, and frees
+ *                       it. If NOHANG is set and no such child has
+ *                       exited yet, hands back pid 0 instead of
+ *                       waiting. Returns EINVAL if PID isn't a child
+ *                       of the current process, or if PID is -1 and
+ *                       there are no children to wait for.
+ *     proc_lookup     - return the process with pid PID, or NULL.
+ *     proc_printstats - print every process and its thread's
+ *                       scheduling statistics.
+ *
+ * All but proc_bootstrap and proc_printstats must be called with
+ * interrupts off.
+ */
+
+struct thread;
+
+struct proc {
+	pid_t p_pid;
+	struct proc *p_parent;		/* NULL only for the kernel process */
+	struct proc *p_children;	/* children still running */
+	struct proc *p_zombies;		/* children that have exited */
+	unsigned p_nwaitable;		/* children not detached */
+	struct proc *p_nextsib;		/* on one of the parent's lists */
+	struct proc *p_prevsib;
+	struct thread *p_thread;	/* NULL once exited */
+	int p_detached;			/* no one will wait; free at exit */
+	int p_exitcode;
+};
+
+/* The kernel process. */
+extern struct proc *kernproc;
+
+void         proc_bootstrap(struct thread *first);
+int          proc_create(struct thread *t, int detached);
+void         proc_destroy(struct proc *p);
+void         proc_exit(struct proc *p, int exitcode);
+int          proc_wait(pid_t pid, int nohang, pid_t *retpid,
+                       int *exitcode);
+struct proc *proc_lookup(pid_t pid);
+void         proc_printstats(void);
+
+#endif /* _PROC_H_ */
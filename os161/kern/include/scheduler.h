@@ -9,7 +9,11 @@
  *                     already on the run queue or sleeping, weird things
  *                     may happen. Returns an error code.
  *
+ *     scheduler_tick - charge the current thread for a clock tick.
+ *                     Returns nonzero if it should yield.
+ *
  *     print_run_queue - dump the run queue to the console for debugging.
+ *     scheduler_printstats - print scheduler statistics.
  *
  *     scheduler_bootstrap - initialize scheduler data 
  *                           (must happen early in boot)
@@ -20,10 +24,15 @@
 
 struct thread;
 
+/* Number of priority levels; 0 is the most important. */
+#define NPRIO 4
+
 struct thread *scheduler(void);
 int make_runnable(struct thread *t);
+int scheduler_tick(void);
 
 void print_run_queue(void);
+void scheduler_printstats(void);
 
 void scheduler_bootstrap(void);
 int scheduler_preallocate(int numthreads);
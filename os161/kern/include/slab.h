@@ -0,0 +1,74 @@
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+/*
+ * Slab allocator: caches of fixed-size kernel objects.
+ *
+ * Each cache hands out objects of one type from slabs, which are
+ * single pages carved into as many objects as fit. Allocating and
+ * freeing an object is O(1) and wastes nothing to rounding, unlike
+ * kmalloc's power-of-two size classes.
+ *
+ * If a cache has a constructor, it is run on each object once, when
+ * the slab holding it is created. Objects must be handed back to
+ * slab_free in their constructed state, so the constructor's work
+ * needn't be redone on the next allocation.
+ *
+ * Slabs with no objects in use are kept for reuse, up to a limit; the
+ * rest are given back to the VM system. slab_reapall gives back all of
+ * them, and is called when physical memory runs out.
+ *
+ * Caches are declared statically with SLAB_CACHE, e.g.
+ *
+ *     static struct slab_cache thread_cache =
+ *         SLAB_CACHE("thread", sizeof(struct thread), NULL);
+ *
+ * and need no other setup.
+ *
+ * Functions:
+ *     slab_alloc      - allocate an object. Returns NULL if out of
+ *                       memory.
+ *     slab_free       - free an object allocated from the same cache.
+ *     slab_reap       - give back a cache's empty slabs. Returns the
+ *                       number of pages freed.
+ *     slab_reapall    - slab_reap every cache.
+ *     slab_printstats - print every cache's statistics.
+ *
+ * All may be called with interrupts on or off.
+ */
+
+struct slab;
+
+struct slab_cache {
+	const char *sc_name;
+	size_t sc_size;			/* object size, as given */
+	void (*sc_ctor)(void *obj);	/* constructor, or NULL */
+
+	/* The rest is set up when the first slab is created. */
+	size_t sc_objsize;		/* object plus free list link */
+	unsigned sc_perslab;		/* objects per slab */
+	struct slab *sc_partial;	/* slabs with some objects free */
+	struct slab *sc_full;		/* slabs with none free */
+	struct slab *sc_empty;		/* slabs with all objects free */
+	unsigned sc_nempty;
+	struct slab_cache *sc_next;	/* list of all caches in use */
+
+	/* Statistics */
+	u_int32_t sc_nslabs;		/* slabs now held */
+	u_int32_t sc_inuse;		/* objects now allocated */
+	u_int32_t sc_allocs;
+	u_int32_t sc_frees;
+	u_int32_t sc_grows;		/* slabs created */
+	u_int32_t sc_reaped;		/* slabs given back */
+};
+
+#define SLAB_CACHE(name, size, ctor) \
+	{ name, size, ctor, 0, 0, NULL, NULL, NULL, 0, NULL, 0, 0, 0, 0, 0, 0 }
+
+void    *slab_alloc(struct slab_cache *sc);
+void     slab_free(struct slab_cache *sc, void *obj);
+unsigned slab_reap(struct slab_cache *sc);
+unsigned slab_reapall(void);
+void     slab_printstats(void);
+
+#endif /* _SLAB_H_ */
@@ -0,0 +1,55 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap space and the page-out daemon.
+ *
+ * Swap lives on a whole raw disk, SWAP_DEVICE, divided into page-sized
+ * slots. A bitmap records which slots are in use. If the device isn't
+ * there, the system runs without swap.
+ *
+ * The page-out daemon is a kernel thread that sleeps until free memory
+ * drops below PAGEOUT_LOWATER pages, then writes user pages out to
+ * swap until at least PAGEOUT_HIWATER pages are free again. When swap
+ * is full or missing, it throws out pages of the file cache instead,
+ * with vmobj_reclaim. If a pass finds nothing it can evict, the daemon
+ * stalls: it sleeps until a page is freed or someone new waits for
+ * memory, rather than trying again straight away.
+ *
+ * Functions:
+ *     swap_bootstrap - open the swap device, if any, and start the
+ *                      daemon.
+ *     swap_alloc     - reserve a swap slot. Returns ENOSPC if swap is
+ *                      full or missing.
+ *     swap_free      - release a swap slot.
+ *     swap_read      - read swap slot SLOT into physical page PADDR.
+ *     swap_write     - write physical page PADDR to swap slot SLOT.
+ *     swap_printstats - print swap usage to the console.
+ *     swap_kick      - tell the daemon memory is getting low.
+ *     swap_pagefreed - tell the daemon a page was freed, in case it
+ *                      has stalled. Interrupts must be off.
+ *     swap_wait      - wait for the daemon to free some memory. Returns
+ *                      nonzero if it can't help (nothing left to
+ *                      evict, or the caller can't sleep). Interrupts
+ *                      must be off.
+ */
+
+#define SWAP_DEVICE      "lhd1raw:"
+
+/* Not a swap slot. */
+#define SWAP_NOSLOT      ((u_int32_t)-1)
+
+#define PAGEOUT_LOWATER  8
+#define PAGEOUT_HIWATER  16
+
+void swap_bootstrap(void);
+int  swap_alloc(u_int32_t *slot);
+void swap_free(u_int32_t slot);
+int  swap_read(u_int32_t slot, paddr_t paddr);
+int  swap_write(u_int32_t slot, paddr_t paddr);
+void swap_printstats(void);
+void swap_kick(void);
+void swap_pagefreed(void);
+int  swap_wait(void);
+
+#endif /* _SWAP_H_ */
@@ -12,7 +12,8 @@
  *                   the count is 1 again before decrementing.
  *     V (verhogen): increment count.
  * 
- * Both operations are atomic.
+ * Both operations are atomic. If threads are blocked in P, V gives
+ * its increment directly to the one that has waited longest.
  *
  * The name field is for easier debugging. A copy of the name is made
  * internally.
@@ -41,6 +42,11 @@ void              sem_destroy(struct semaphore *);
  *
  * These operations must be atomic. You get to write them.
  *
+ * Waiting threads get the lock in the order they asked for it:
+ * lock_release hands it directly to the longest waiter. acquires and
+ * contended count how often the lock was taken, and how often that
+ * meant waiting for it.
+ *
  * When the lock is created, no thread should be holding it. Likewise,
  * when the lock is destroyed, no thread should be holding it.
  *
@@ -53,6 +59,8 @@ struct lock {
 	// add what you need here
 	// (don't forget to mark things volatile as needed)
 	volatile struct thread *holding_thread;
+	unsigned acquires;
+	unsigned contended;
 };
 
 struct lock *lock_create(const char *name);
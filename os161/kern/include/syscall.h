@@ -7,7 +7,12 @@
 
 int sys_reboot(int code);
 int sys_write(int fd, const void *buf, size_t nbytes, int32_t *retval);
-int sys_read(int fd, void *buf, size_t buflen);
+int sys_read(int fd, void *buf, size_t buflen, int32_t *retval);
+int sys_open(const char *filename, int flags, int32_t *retval);
+int sys_close(int fd);
+int sys_lseek(int fd, off_t pos, int whence, int32_t *retval);
+int sys_dup2(int oldfd, int newfd, int32_t *retval);
+int sys_fsync(int fd);
 unsigned int sys_sleep(unsigned int seconds);
 time_t sys_time(time_t *seconds, unsigned long *nanoseconds);
 pid_t sys_fork(struct trapframe *tf, int *err);
@@ -16,5 +21,9 @@ pid_t sys_waitpid(pid_t pid, int *status, int options, int *err);
 void sys__exit(int exitcode);
 int sys_execv(const char *program, char ** args, int *err);
 int next_multiple_of_4(int num);
+int sys_sbrk(intptr_t change, int32_t *retval);
+int sys_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset,
+	     int32_t *retval);
+int sys_munmap(void *addr, size_t len);
 
 #endif /* _SYSCALL_H_ */
@@ -12,17 +12,10 @@
 #include <array.h>
 #include <synch.h>
 
-
-// we can have at most 16 threads running at a time
-// more than 18 fails forkbomb, less than 16 fails forktest
-#define MAX_THREADS 16
-
 struct addrspace;
-
-struct exitted_thread {
-	pid_t pid;
-	int exitcode;
-};
+struct sleepq;
+struct proc;
+struct filetable;
 
 struct thread {
 	/**********************************************************/
@@ -32,6 +25,12 @@ struct thread {
 	struct pcb t_pcb;
 	char *t_name;
 	const void *t_sleepaddr;
+	struct sleepq *t_sleepq;	/* ours to lend, when not asleep */
+	struct thread *t_sleepnext;	/* next sleeper on the same address */
+	int t_priority;			/* scheduler level; see scheduler.c */
+	unsigned t_ticks;		/* ticks used of the current quantum */
+	u_int32_t t_cputicks;		/* ticks run altogether */
+	struct thread *t_runnext;	/* next on the same run queue */
 	char *t_stack;
 	
 	/**********************************************************/
@@ -52,41 +51,19 @@ struct thread {
 	struct vnode *t_cwd;
 
 	/*
-	 * Process related stuff:
-	 * pid: unique pid of thread (starting from 1)
-	 * ppid: parent pid
-	 * child_exit_codes: 
-	 * when a child exits, should notify parent of its exit code. 
-	 * Such exit codes (of type struct exitted_thread *) are stored in exit_codes
+	 * The process this thread is running. NULL once it has exited.
 	 */
-	pid_t pid;
-	pid_t ppid;
-	struct array *child_exit_codes;
-};
+	struct proc *t_proc;
 
-void print_thread_array();
+	/*
+	 * Open file descriptors, for threads running a user program;
+	 * NULL otherwise. See file.h.
+	 */
+	struct filetable *t_filetable;
+};
 
 void print_sleepers();
 
-/* pid_list methods */
-pid_t get_smallest_available_pid();
-
-void recycle_pid(pid_t pid);
-
-void initialize_pid_list();
-
-void print_pid_list();
-
-/* thread_array methods */
-struct thread *
-get_thread_from_array(pid_t pid);
-
-int
-add_thread_to_array(struct thread *t);
-
-int
-remove_thread_from_array(pid_t pid);
-
 /* Call once during startup to allocate data structures. */
 struct thread *thread_bootstrap(void);
 
@@ -106,7 +83,9 @@ int thread_count(void);
  * the new one. If "ret" is non-null, the thread structure for the new
  * thread is handed back. (Note that using said thread structure from
  * the parent thread should be done only with caution, because in
- * general the child thread might exit at any time.) Returns an error
+ * general the child thread might exit at any time.) If "ret" is null,
+ * the new thread's process is detached: nothing can wait for it, and
+ * it is cleaned up as soon as it exits. Returns an error
  * code.
  */
 int thread_fork(const char *name, 
@@ -115,10 +94,12 @@ int thread_fork(const char *name,
 		struct thread **ret);
 
 /*
- * Suspend execution of the calling thread until the target thread 
- * terminates, unless the target thread has already terminated.
+ * Suspend execution of the calling thread until its child process PID
+ * terminates, unless it has already terminated, and collect its exit
+ * code. Returns an error code. The child must not have been forked
+ * detached (with RET NULL).
  */
-int thread_join(struct thread * thread);
+int thread_join(pid_t pid, int *exitcode);
 
 /*
  * Cause the current thread to exit.
@@ -143,10 +124,11 @@ void thread_yield(void);
 void thread_sleep(const void *addr);
 
 /*
- * Cause one thread sleeping on the specified address to wake up.
+ * Cause the thread that has slept longest on the specified address to
+ * wake up, and return it; return NULL if nothing was sleeping there.
  * Interrupts must be disabled.
  */
-void thread_single_wakeup(const void *addr);
+struct thread *thread_single_wakeup(const void *addr);
 
 /*
  * Cause all threads sleeping on the specified address to wake up.
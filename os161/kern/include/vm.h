@@ -27,4 +27,46 @@ int vm_fault(int faulttype, vaddr_t faultaddress);
 vaddr_t alloc_kpages(int npages);
 void free_kpages(vaddr_t addr);
 
+#if !OPT_DUMBVM
+struct addrspace;
+
+/*
+ * TLB management. Only one address space has its translations in the
+ * TLB at a time; the rest are saved in the address space.
+ *
+ *     vm_tlbactivate   - switch the TLB over to AS (or to nothing, if
+ *                        AS is NULL). Free if AS is already there.
+ *     vm_tlbforget     - drop everything about AS, which is being
+ *                        destroyed.
+ *     vm_tlbflush      - drop all of AS's translations.
+ *     vm_tlbinvalidate - drop AS's translation for VADDR, if any.
+ */
+void vm_tlbactivate(struct addrspace *as);
+void vm_tlbforget(struct addrspace *as);
+void vm_tlbflush(struct addrspace *as);
+void vm_tlbinvalidate(struct addrspace *as, vaddr_t vaddr);
+
+/*
+ * Paging counters, for comparing replacement policies. TLB misses
+ * count refills. Every fault, including writes to shared or clean
+ * pages, is also counted as minor (handled without I/O) or major
+ * (read the page from swap).
+ * Evictions count pages paged out, and writebacks those of them that
+ * had to be written because swap didn't have an up-to-date copy.
+ */
+struct vmstats {
+	u_int32_t vs_tlbmisses;
+	u_int32_t vs_minfaults;
+	u_int32_t vs_majfaults;
+	u_int32_t vs_evictions;
+	u_int32_t vs_writebacks;
+};
+
+extern struct vmstats vmstats;
+
+/* Print, or zero, the counters */
+void vm_printstats(void);
+void vm_resetstats(void);
+#endif
+
 #endif /* _VM_H_ */
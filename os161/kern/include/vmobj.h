@@ -0,0 +1,76 @@
+#ifndef _VMOBJ_H_
+#define _VMOBJ_H_
+
+/*
+ * Shared file pages.
+ *
+ * A vmobj caches pages of one file, so that every address space that
+ * maps the same part of the same file read-only uses the same frames.
+ * Program text is mapped this way, so twenty copies of sh share one
+ * copy of its code.
+ *
+ * The object holds a coremap reference to each page it has cached, and
+ * each PTE that maps one holds another. Cached pages are thus always
+ * shared, and never go to swap. Instead, when memory is short the
+ * page-out daemon calls vmobj_reclaim, which throws a page out of the
+ * cache and clears the PTEs mapping it; the next touch reads it from
+ * the file again. A dirty page is written back before it's dropped.
+ *
+ * Shared writeable mappings (mmap with MAP_SHARED) write straight into
+ * the cached pages. Those pages are written back to the file by
+ * vmobj_sync, and when the object goes away. Writing a page back takes
+ * away write access to it, so the next store through a mapping marks
+ * it dirty again. Each address space region mapping the object is
+ * recorded with vmobj_map, so those mappings can be found.
+ *
+ * write() to a file that has an object goes through vmobj_write, which
+ * copies the new data into any cached pages it covers.
+ *
+ * There's no lock: objects are looked at with interrupts off, and a
+ * page being read in or written back is marked busy while the I/O is
+ * in progress, so faults on other pages of the same file go ahead.
+ *
+ * Functions:
+ *     vmobj_get       - find or create the object for vnode V and add
+ *                       a user to it.
+ *     vmobj_incref    - add a user to an object already in use.
+ *     vmobj_release   - drop a user; the last one writes back dirty
+ *                       pages and frees the object.
+ *     vmobj_map       - note that region RG of address space AS maps
+ *                       the object. Returns an error code.
+ *     vmobj_unmap     - undo vmobj_map, before RG goes away.
+ *     vmobj_getpage   - return the page at (page-aligned) file offset
+ *                       OFFSET, reading it in if it isn't cached yet.
+ *                       The caller gets a reference of its own.
+ *     vmobj_dirty     - note that the page at OFFSET, which must be
+ *                       cached, is about to be written.
+ *     vmobj_sync      - write dirty pages back to the file.
+ *     vmobj_syncvnode - vmobj_sync the object for vnode V, if there is
+ *                       one; never creates one. For fsync.
+ *     vmobj_write     - VOP_WRITE to V, keeping any cached pages up to
+ *                       date. For write().
+ *     vmobj_reclaim   - free one cached page, of any object. Returns
+ *                       nonzero if there was none to free.
+ */
+
+struct vnode;
+struct uio;
+struct addrspace;
+struct region;
+struct vmobj;
+
+int  vmobj_get(struct vnode *v, struct vmobj **ret);
+void vmobj_incref(struct vmobj *obj);
+void vmobj_release(struct vmobj *obj);
+int  vmobj_map(struct vmobj *obj, struct addrspace *as,
+               const struct region *rg);
+void vmobj_unmap(struct vmobj *obj, struct addrspace *as,
+                 const struct region *rg);
+int  vmobj_getpage(struct vmobj *obj, off_t offset, paddr_t *ret);
+void vmobj_dirty(struct vmobj *obj, off_t offset);
+int  vmobj_sync(struct vmobj *obj);
+int  vmobj_syncvnode(struct vnode *v);
+int  vmobj_write(struct vnode *v, struct uio *u);
+int  vmobj_reclaim(void);
+
+#endif /* _VMOBJ_H_ */
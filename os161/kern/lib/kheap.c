@@ -1,7 +1,14 @@
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <vm.h>
 #include <machine/spl.h>
+#if OPT_KMALLOCTRACE
+#include <slab.h>
+
+/* The real kmalloc is defined here; traced calls come through kmalloc_traced. */
+#undef kmalloc
+#endif
 
 static
 void
@@ -39,7 +46,9 @@ fill_deadbeef(void *vptr, size_t len)
 //    The free counts and addresses of the pages are maintained in
 //    another list.  Maintaining this table is a nuisance, because it
 //    cannot recursively use the subpage allocator. (We could probably
-//    make that work, but it would be painful.)
+//    make that work, but it would be painful.) So the table entries
+//    (pagerefs) are carved out of whole pages of their own, and found
+//    again by a hash on page address.
 //
 
 #undef  SLOW	/* consistency checks */
@@ -70,6 +79,7 @@ struct freelist {
 struct pageref {
 	struct pageref *next_samesize;
 	struct pageref *next_all;
+	struct pageref *next_hash;
 	vaddr_t pageaddr_and_blocktype;
 	u_int16_t freelist_offset;
 	u_int16_t nfree;
@@ -84,67 +94,159 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * This is cheesy. 
- *
- * The problem is not that it's wasteful - we can only allocate whole
- * pages of pageref structures at a time anyway. The problem is that
- * we really ought to be able to have more than one of these pages.
- *
- * However, for the time being, one page worth of pagerefs gives us
- * 256 pagerefs; this lets us manage 256 * 4k = 1M of kernel heap.
- * That would be twice as much memory as we get for *everything*.
- * Thus, we will cheat and not allow any mechanism for having a second
- * page of pageref structs.
- *
- * Then, since the size is fixed at one page, we'll simplify a bit
- * further by allocating the page in the kernel BSS instead of calling
- * alloc_kpages to get it.
+ * Pagerefs are allocated a page at a time, as needed, and kept on a
+ * free list when not in use. One page of pagerefs manages 256 pages
+ * (1M) of heap; the pages are never given back.
  */
 
-#define NPAGEREFS (PAGE_SIZE / sizeof(struct pageref))
-static struct pageref pagerefs[NPAGEREFS];
+#define NPAGEREFS_PER_PAGE (PAGE_SIZE / sizeof(struct pageref))
 
-#define INUSE_WORDS (NPAGEREFS/32)
-static u_int32_t pagerefs_inuse[INUSE_WORDS];
+static struct pageref *freepagerefs;
+static unsigned npagerefs;	/* allocated, whether in use or not */
 
 static
 struct pageref *
 allocpageref(void)
 {
-	unsigned i,j;
-	u_int32_t k;
+	struct pageref *pr;
+	vaddr_t page;
+	unsigned i;
 
-	for (i=0; i<INUSE_WORDS; i++) {
-		if (pagerefs_inuse[i]==0xffffffff) {
-			/* full */
-			continue;
+	if (freepagerefs == NULL) {
+		page = alloc_kpages(1);
+		if (page == 0) {
+			return NULL;
 		}
-		for (k=1,j=0; k!=0; k<<=1,j++) {
-			if ((pagerefs_inuse[i] & k)==0) {
-				pagerefs_inuse[i] |= k;
-				return &pagerefs[i*32 + j];
-			}
+		pr = (struct pageref *)page;
+		for (i=0; i<NPAGEREFS_PER_PAGE; i++) {
+			pr[i].next_all = freepagerefs;
+			freepagerefs = &pr[i];
 		}
-		assert(0);
+		npagerefs += NPAGEREFS_PER_PAGE;
 	}
 
-	/* ran out */
-	return NULL;
+	pr = freepagerefs;
+	freepagerefs = pr->next_all;
+	return pr;
 }
 
 static
 void
 freepageref(struct pageref *p)
 {
-	size_t i, j;
-	u_int32_t k;
-
-	j = p-pagerefs;
-	assert(j < NPAGEREFS);  /* note: j is unsigned, don't test < 0 */
-	i = j/32;
-	k = ((u_int32_t)1) << (j%32);
-	assert((pagerefs_inuse[i] & k) != 0);
-	pagerefs_inuse[i] &= ~k;
+	p->next_all = freepagerefs;
+	freepagerefs = p;
+}
+
+////////////////////////////////////////
+
+/*
+ * Hash table of pagerefs in use, keyed by page address, so kfree can
+ * find a block's pageref without searching them all. The table starts
+ * at one page of buckets and doubles whenever there are more than
+ * PRHASH_LOAD pagerefs per bucket, so the chains stay short however
+ * much memory ends up as heap.
+ */
+
+#define PRHASH_LOAD     2
+#define PRHASH(va)      (((va) / PAGE_SIZE) & (prhash_size - 1))
+
+static struct pageref **prhash;
+static unsigned prhash_size;	/* number of buckets; a power of two */
+static unsigned prhash_count;	/* number of pagerefs in it */
+
+/*
+ * Try to move the hash table to a bigger one. If there's no memory,
+ * keep the old one; the chains just get longer.
+ */
+static
+void
+prhash_grow(void)
+{
+	struct pageref **newhash, *pr;
+	unsigned oldsize, newsize, i, npages;
+	vaddr_t page;
+
+	newsize = prhash_size ? prhash_size * 2
+		: PAGE_SIZE / sizeof(struct pageref *);
+	npages = DIVROUNDUP(newsize * sizeof(struct pageref *), PAGE_SIZE);
+
+	page = alloc_kpages(npages);
+	if (page == 0) {
+		return;
+	}
+	newhash = (struct pageref **)page;
+	for (i=0; i<newsize; i++) {
+		newhash[i] = NULL;
+	}
+
+	oldsize = prhash_size;
+	prhash_size = newsize;
+	for (i=0; i<oldsize; i++) {
+		while (prhash[i] != NULL) {
+			pr = prhash[i];
+			prhash[i] = pr->next_hash;
+			pr->next_hash = newhash[PRHASH(PR_PAGEADDR(pr))];
+			newhash[PRHASH(PR_PAGEADDR(pr))] = pr;
+		}
+	}
+
+	if (prhash != NULL) {
+		free_kpages((vaddr_t)prhash);
+	}
+	prhash = newhash;
+}
+
+static
+int
+prhash_add(struct pageref *pr)
+{
+	if (prhash_count >= PRHASH_LOAD * prhash_size) {
+		prhash_grow();
+		if (prhash == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	pr->next_hash = prhash[PRHASH(PR_PAGEADDR(pr))];
+	prhash[PRHASH(PR_PAGEADDR(pr))] = pr;
+	prhash_count++;
+	return 0;
+}
+
+static
+void
+prhash_remove(struct pageref *pr)
+{
+	struct pageref **guy;
+
+	for (guy = &prhash[PRHASH(PR_PAGEADDR(pr))]; *guy;
+	     guy = &(*guy)->next_hash) {
+		if (*guy == pr) {
+			*guy = pr->next_hash;
+			prhash_count--;
+			return;
+		}
+	}
+	panic("kheap: pageref for 0x%lx not hashed\n",
+	      (unsigned long)PR_PAGEADDR(pr));
+}
+
+static
+struct pageref *
+prhash_find(vaddr_t page)
+{
+	struct pageref *pr;
+
+	if (prhash == NULL) {
+		return NULL;
+	}
+	for (pr = prhash[PRHASH(page)]; pr != NULL; pr = pr->next_hash) {
+		if (PR_PAGEADDR(pr) == page) {
+			return pr;
+		}
+	}
+	return NULL;
 }
 
 ////////////////////////////////////////
@@ -215,18 +317,20 @@ checksubpages(void)
 	for (i=0; i<NSIZES; i++) {
 		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
 			checksubpage(pr);
-			assert(sc < NPAGEREFS);
+			assert(sc < npagerefs);
 			sc++;
 		}
 	}
 
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
 		checksubpage(pr);
-		assert(ac < NPAGEREFS);
+		assert(ac < npagerefs);
+		assert(prhash_find(PR_PAGEADDR(pr)) == pr);
 		ac++;
 	}
 
 	assert(sc==ac);
+	assert(ac==prhash_count);
 }
 #else
 #define checksubpages() 
@@ -294,6 +398,8 @@ kheap_printstats(void)
 	int spl = splhigh();
 
 	kprintf("Subpage allocator status:\n");
+	kprintf("%u pages in use, %u pagerefs allocated, %u hash buckets\n",
+		prhash_count, npagerefs, prhash_size);
 
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
 		dumpsubpage(pr);
@@ -327,6 +433,8 @@ remove_lists(struct pageref *pr, int blktype)
 			break;
 		}
 	}
+
+	prhash_remove(pr);
 }
 
 static
@@ -431,6 +539,14 @@ subpage_kmalloc(size_t sz)
 	pr->pageaddr_and_blocktype = MKPAB(prpage, blktype);
 	pr->nfree = PAGE_SIZE / sizes[blktype];
 
+	if (prhash_add(pr)) {
+		free_kpages(prpage);
+		freepageref(pr);
+		splx(spl);
+		kprintf("kmalloc: Subpage allocator couldn't hash pageref\n"); 
+		return NULL;
+	}
+
 	/*
 	 * Note: fl is volatile because the MIPS toolchain we were
 	 * using in spring 2001 attempted to optimize this loop and
@@ -478,25 +594,20 @@ subpage_kfree(void *ptr)
 
 	checksubpages();
 
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-
-		/* check for corruption */
-		assert(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
-		}
-	}
-
+	pr = prhash_find(ptraddr & PAGE_FRAME);
 	if (pr==NULL) {
 		/* Not on any of our pages - not a subpage allocation */
 		splx(spl);
 		return -1;
 	}
 
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+
+	/* check for corruption */
+	assert(blktype>=0 && blktype<NSIZES);
+	checksubpage(pr);
+
 	offset = ptraddr - prpage;
 
 	/* Check for proper positioning and alignment */
@@ -542,6 +653,269 @@ subpage_kfree(void *ptr)
 //
 ////////////////////////////////////////////////////////////
 
+#if OPT_KMALLOCTRACE
+
+////////////////////////////////////////////////////////////
+//
+// kmalloc tracing.
+//
+// Each callsite (file and line) that has called kmalloc has a ksite,
+// hashed by line, holding running totals. Each live traced allocation
+// has a ktrace, hashed by address, pointing at its callsite. Both come
+// from slab caches rather than kmalloc, so tracing never traces itself.
+//
+// Allocations are numbered in order. This serial number stands in for
+// a timestamp (the clock can't be read this early in boot): the leak
+// report lists what was allocated after the last mark.
+//
+
+#define KT_NSITEHASH  128
+#define KT_NLIVEHASH  1024
+#define KT_TOPSITES   16
+
+struct ksite {
+	const char *ks_file;
+	int ks_line;
+	u_int32_t ks_allocs;		/* allocations made */
+	u_int32_t ks_bytes;		/* bytes allocated */
+	u_int32_t ks_live;		/* allocations not yet freed */
+	u_int32_t ks_livebytes;
+	struct ksite *ks_next;
+};
+
+struct ktrace {
+	void *kt_ptr;
+	size_t kt_size;
+	u_int32_t kt_serial;
+	struct ksite *kt_site;
+	struct ktrace *kt_next;
+};
+
+static struct slab_cache ksite_cache =
+	SLAB_CACHE("ksite", sizeof(struct ksite), NULL);
+static struct slab_cache ktrace_cache =
+	SLAB_CACHE("ktrace", sizeof(struct ktrace), NULL);
+
+static struct ksite *ksitehash[KT_NSITEHASH];
+static struct ktrace *ktracehash[KT_NLIVEHASH];
+static unsigned kt_nsites;
+static u_int32_t kt_serial;	/* last allocation number handed out */
+static u_int32_t kt_mark;	/* kt_serial at the last mark */
+static u_int32_t kt_untraced;	/* allocations we had no memory to record */
+
+#define KT_SITEHASH(line)  ((unsigned)(line) % KT_NSITEHASH)
+#define KT_LIVEHASH(ptr)   (((vaddr_t)(ptr) >> 4) % KT_NLIVEHASH)
+
+/*
+ * Find the callsite FILE:LINE. Interrupts must be off.
+ */
+static
+struct ksite *
+ksite_find(const char *file, int line)
+{
+	struct ksite *ks;
+
+	for (ks = ksitehash[KT_SITEHASH(line)]; ks != NULL; ks = ks->ks_next) {
+		if (ks->ks_line == line && !strcmp(ks->ks_file, file)) {
+			return ks;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Record that PTR, of SZ bytes, was allocated at FILE:LINE.
+ *
+ * Records are allocated before interrupts go off, since the slab
+ * allocator may sleep waiting for memory.
+ */
+static
+void
+ktrace_add(void *ptr, size_t sz, const char *file, int line)
+{
+	struct ktrace *kt;
+	struct ksite *ks, *newks = NULL;
+	unsigned h;
+	int spl;
+
+	kt = slab_alloc(&ktrace_cache);
+	if (kt == NULL) {
+		kt_untraced++;
+		return;
+	}
+
+	spl = splhigh();
+	ks = ksite_find(file, line);
+	if (ks == NULL) {
+		splx(spl);
+		newks = slab_alloc(&ksite_cache);
+		if (newks == NULL) {
+			slab_free(&ktrace_cache, kt);
+			kt_untraced++;
+			return;
+		}
+		spl = splhigh();
+
+		/* Someone else may have added it while we slept. */
+		ks = ksite_find(file, line);
+		if (ks == NULL) {
+			ks = newks;
+			newks = NULL;
+			ks->ks_file = file;
+			ks->ks_line = line;
+			ks->ks_allocs = ks->ks_bytes = 0;
+			ks->ks_live = ks->ks_livebytes = 0;
+			h = KT_SITEHASH(line);
+			ks->ks_next = ksitehash[h];
+			ksitehash[h] = ks;
+			kt_nsites++;
+		}
+	}
+
+	ks->ks_allocs++;
+	ks->ks_bytes += sz;
+	ks->ks_live++;
+	ks->ks_livebytes += sz;
+
+	kt->kt_ptr = ptr;
+	kt->kt_size = sz;
+	kt->kt_serial = ++kt_serial;
+	kt->kt_site = ks;
+	h = KT_LIVEHASH(ptr);
+	kt->kt_next = ktracehash[h];
+	ktracehash[h] = kt;
+
+	splx(spl);
+
+	if (newks != NULL) {
+		slab_free(&ksite_cache, newks);
+	}
+}
+
+/*
+ * Forget the allocation PTR, if it was traced.
+ */
+static
+void
+ktrace_remove(void *ptr)
+{
+	struct ktrace *kt, **ktp;
+	int spl;
+
+	spl = splhigh();
+	for (ktp = &ktracehash[KT_LIVEHASH(ptr)]; *ktp != NULL;
+	     ktp = &(*ktp)->kt_next) {
+		kt = *ktp;
+		if (kt->kt_ptr == ptr) {
+			*ktp = kt->kt_next;
+			kt->kt_site->ks_live--;
+			kt->kt_site->ks_livebytes -= kt->kt_size;
+			splx(spl);
+			slab_free(&ktrace_cache, kt);
+			return;
+		}
+	}
+	splx(spl);
+}
+
+void *
+kmalloc_traced(size_t sz, const char *file, int line)
+{
+	void *ptr;
+
+	ptr = kmalloc(sz);
+	if (ptr != NULL) {
+		ktrace_add(ptr, sz, file, line);
+	}
+	return ptr;
+}
+
+void
+kheap_tracereport(int bylive)
+{
+	struct ksite *top[KT_TOPSITES];
+	struct ksite *ks;
+	u_int32_t key;
+	unsigned i, j, ntop = 0;
+	int spl;
+
+	/* Keep the biggest KT_TOPSITES sites in top[], largest first. */
+#define KT_KEY(ks) (bylive ? (ks)->ks_livebytes : (ks)->ks_bytes)
+
+	spl = splhigh();
+
+	for (i=0; i<KT_NSITEHASH; i++) {
+		for (ks = ksitehash[i]; ks != NULL; ks = ks->ks_next) {
+			key = KT_KEY(ks);
+			for (j=ntop; j>0 && KT_KEY(top[j-1]) < key; j--) {
+				if (j < KT_TOPSITES) {
+					top[j] = top[j-1];
+				}
+			}
+			if (j < KT_TOPSITES) {
+				top[j] = ks;
+				if (ntop < KT_TOPSITES) {
+					ntop++;
+				}
+			}
+		}
+	}
+
+	kprintf("kmalloc callsites by %s (%u sites, %u allocations, "
+		"%u untraced):\n", bylive ? "bytes in use" : "bytes allocated",
+		kt_nsites, kt_serial, kt_untraced);
+	kprintf("  allocs     bytes   live  livebytes  callsite\n");
+	for (i=0; i<ntop; i++) {
+		ks = top[i];
+		kprintf("%8u %9u %6u %10u  %s:%d\n", ks->ks_allocs,
+			ks->ks_bytes, ks->ks_live, ks->ks_livebytes,
+			ks->ks_file, ks->ks_line);
+	}
+
+	splx(spl);
+#undef KT_KEY
+}
+
+void
+kheap_tracemark(void)
+{
+	int spl = splhigh();
+	kt_mark = kt_serial;
+	splx(spl);
+	kprintf("kmalloc leak check starts after allocation %u\n", kt_mark);
+}
+
+void
+kheap_leakreport(void)
+{
+	struct ktrace *kt;
+	unsigned i, n = 0;
+	u_int32_t bytes = 0;
+	int spl;
+
+	spl = splhigh();
+
+	kprintf("kmalloc allocations since %u still in use:\n", kt_mark);
+	for (i=0; i<KT_NLIVEHASH; i++) {
+		for (kt = ktracehash[i]; kt != NULL; kt = kt->kt_next) {
+			if (kt->kt_serial <= kt_mark) {
+				continue;
+			}
+			kprintf("  #%u 0x%lx %u bytes at %s:%d\n",
+				kt->kt_serial, (unsigned long) kt->kt_ptr,
+				kt->kt_size, kt->kt_site->ks_file,
+				kt->kt_site->ks_line);
+			n++;
+			bytes += kt->kt_size;
+		}
+	}
+	kprintf("%u allocations, %u bytes\n", n, bytes);
+
+	splx(spl);
+}
+
+#endif /* OPT_KMALLOCTRACE */
+
 void *
 kmalloc(size_t sz)
 {
@@ -570,7 +944,11 @@ kfree(void *ptr)
 	 */
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	}
+#if OPT_KMALLOCTRACE
+	ktrace_remove(ptr);
+#endif
+	if (subpage_kfree(ptr)) {
 		assert((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
@@ -0,0 +1,286 @@
+/*
+ * Slab allocator. See slab.h.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <vm.h>
+#include <slab.h>
+#include <machine/spl.h>
+
+/*
+ * Slab header, at the start of each slab's page. The objects follow
+ * it. Each free object's free list link is kept just past the object
+ * rather than in it, so a free object stays constructed.
+ */
+struct slab {
+	struct slab_cache *sl_cache;
+	struct slab *sl_next;	/* links on one of the cache's lists */
+	struct slab *sl_prev;
+	void *sl_free;		/* first free object */
+	unsigned sl_nfree;
+};
+
+/* Objects (and the header) are kept 8-byte aligned. */
+#define SLAB_ALIGN(sz)     (((sz) + 7) & ~(size_t)7)
+#define SLAB_HDRSIZE       SLAB_ALIGN(sizeof(struct slab))
+
+/* The free list link of object OBJ. */
+#define SLAB_LINK(sc, obj) \
+	(*(void **)((char *)(obj) + (sc)->sc_objsize - sizeof(void *)))
+
+/* Empty slabs kept by each cache before they're given back. */
+#define SLAB_MAXEMPTY      1
+
+/* All caches that have been used. */
+static struct slab_cache *allcaches;
+
+////////////////////////////////////////
+
+static
+void
+slablist_push(struct slab **list, struct slab *sl)
+{
+	sl->sl_prev = NULL;
+	sl->sl_next = *list;
+	if (*list != NULL) {
+		(*list)->sl_prev = sl;
+	}
+	*list = sl;
+}
+
+static
+void
+slablist_unlink(struct slab **list, struct slab *sl)
+{
+	if (sl->sl_prev != NULL) {
+		sl->sl_prev->sl_next = sl->sl_next;
+	}
+	else {
+		assert(*list == sl);
+		*list = sl->sl_next;
+	}
+	if (sl->sl_next != NULL) {
+		sl->sl_next->sl_prev = sl->sl_prev;
+	}
+	sl->sl_next = sl->sl_prev = NULL;
+}
+
+////////////////////////////////////////
+
+/*
+ * Work out the cache's layout the first time it's used.
+ */
+static
+void
+slab_setup(struct slab_cache *sc)
+{
+	sc->sc_objsize = SLAB_ALIGN(sc->sc_size + sizeof(void *));
+	sc->sc_perslab = (PAGE_SIZE - SLAB_HDRSIZE) / sc->sc_objsize;
+	if (sc->sc_perslab == 0) {
+		panic("slab: %s: objects of %u bytes don't fit in a page\n",
+		      sc->sc_name, sc->sc_size);
+	}
+
+	sc->sc_next = allcaches;
+	allcaches = sc;
+}
+
+/*
+ * Make a new slab and put it on the empty list. Interrupts must be
+ * off.
+ */
+static
+int
+slab_grow(struct slab_cache *sc)
+{
+	struct slab *sl;
+	vaddr_t page;
+	char *obj;
+	unsigned i;
+
+	page = alloc_kpages(1);
+	if (page == 0) {
+		return ENOMEM;
+	}
+
+	sl = (struct slab *)page;
+	sl->sl_cache = sc;
+	sl->sl_free = NULL;
+	sl->sl_nfree = sc->sc_perslab;
+
+	/* Thread the free list through the objects, lowest first. */
+	obj = (char *)page + SLAB_HDRSIZE + sc->sc_perslab * sc->sc_objsize;
+	for (i=0; i<sc->sc_perslab; i++) {
+		obj -= sc->sc_objsize;
+		if (sc->sc_ctor != NULL) {
+			sc->sc_ctor(obj);
+		}
+		SLAB_LINK(sc, obj) = sl->sl_free;
+		sl->sl_free = obj;
+	}
+
+	slablist_push(&sc->sc_empty, sl);
+	sc->sc_nempty++;
+	sc->sc_nslabs++;
+	sc->sc_grows++;
+	return 0;
+}
+
+/*
+ * Give back an empty slab. Interrupts must be off.
+ */
+static
+void
+slab_release(struct slab_cache *sc, struct slab *sl)
+{
+	assert(sl->sl_nfree == sc->sc_perslab);
+
+	slablist_unlink(&sc->sc_empty, sl);
+	sc->sc_nempty--;
+	sc->sc_nslabs--;
+	sc->sc_reaped++;
+	free_kpages((vaddr_t)sl);
+}
+
+void *
+slab_alloc(struct slab_cache *sc)
+{
+	struct slab *sl;
+	void *obj;
+	int spl;
+
+	spl = splhigh();
+
+	if (sc->sc_perslab == 0) {
+		slab_setup(sc);
+	}
+
+	/* Fill up partly used slabs before starting on empty ones. */
+	sl = sc->sc_partial;
+	if (sl == NULL) {
+		if (sc->sc_empty == NULL && slab_grow(sc)) {
+			splx(spl);
+			return NULL;
+		}
+		sl = sc->sc_empty;
+		slablist_unlink(&sc->sc_empty, sl);
+		sc->sc_nempty--;
+		slablist_push(&sc->sc_partial, sl);
+	}
+
+	assert(sl->sl_nfree > 0);
+	obj = sl->sl_free;
+	sl->sl_free = SLAB_LINK(sc, obj);
+	sl->sl_nfree--;
+
+	if (sl->sl_nfree == 0) {
+		slablist_unlink(&sc->sc_partial, sl);
+		slablist_push(&sc->sc_full, sl);
+	}
+
+	sc->sc_inuse++;
+	sc->sc_allocs++;
+
+	splx(spl);
+	return obj;
+}
+
+void
+slab_free(struct slab_cache *sc, void *obj)
+{
+	struct slab *sl;
+	int spl;
+
+	if (obj == NULL) {
+		return;
+	}
+
+	/* The slab header is at the start of the object's page. */
+	sl = (struct slab *)((vaddr_t)obj & PAGE_FRAME);
+	if (sl->sl_cache != sc ||
+	    ((vaddr_t)obj - (vaddr_t)sl - SLAB_HDRSIZE) % sc->sc_objsize != 0) {
+		panic("slab: %s: free of invalid object %p\n",
+		      sc->sc_name, obj);
+	}
+
+	spl = splhigh();
+
+	SLAB_LINK(sc, obj) = sl->sl_free;
+	sl->sl_free = obj;
+	sl->sl_nfree++;
+	assert(sl->sl_nfree <= sc->sc_perslab);
+
+	if (sl->sl_nfree == 1) {
+		slablist_unlink(&sc->sc_full, sl);
+		slablist_push(&sc->sc_partial, sl);
+	}
+	if (sl->sl_nfree == sc->sc_perslab) {
+		slablist_unlink(&sc->sc_partial, sl);
+		slablist_push(&sc->sc_empty, sl);
+		sc->sc_nempty++;
+		if (sc->sc_nempty > SLAB_MAXEMPTY) {
+			slab_release(sc, sl);
+		}
+	}
+
+	sc->sc_inuse--;
+	sc->sc_frees++;
+
+	splx(spl);
+}
+
+unsigned
+slab_reap(struct slab_cache *sc)
+{
+	unsigned n = 0;
+	int spl;
+
+	spl = splhigh();
+	while (sc->sc_empty != NULL) {
+		slab_release(sc, sc->sc_empty);
+		n++;
+	}
+	splx(spl);
+
+	return n;
+}
+
+unsigned
+slab_reapall(void)
+{
+	struct slab_cache *sc;
+	unsigned n = 0;
+	int spl;
+
+	spl = splhigh();
+	for (sc = allcaches; sc != NULL; sc = sc->sc_next) {
+		n += slab_reap(sc);
+	}
+	splx(spl);
+
+	return n;
+}
+
+void
+slab_printstats(void)
+{
+	struct slab_cache *sc;
+	int spl;
+
+	/* print the whole thing with interrupts off */
+	spl = splhigh();
+
+	kprintf("%-16s %5s %5s %6s %6s %8s %8s %6s %6s\n",
+		"cache", "size", "slabs", "inuse", "total",
+		"allocs", "frees", "grows", "reaped");
+	for (sc = allcaches; sc != NULL; sc = sc->sc_next) {
+		kprintf("%-16s %5u %5u %6u %6u %8u %8u %6u %6u\n",
+			sc->sc_name, sc->sc_size, sc->sc_nslabs,
+			sc->sc_inuse, sc->sc_nslabs * sc->sc_perslab,
+			sc->sc_allocs, sc->sc_frees,
+			sc->sc_grows, sc->sc_reaped);
+	}
+
+	splx(spl);
+}
@@ -7,13 +7,19 @@
 #include <kern/unistd.h>
 #include <kern/limits.h>
 #include <lib.h>
+#include <machine/spl.h>
 #include <clock.h>
 #include <thread.h>
+#include <scheduler.h>
+#include <proc.h>
 #include <syscall.h>
 #include <uio.h>
 #include <vfs.h>
 #include <sfs.h>
 #include <test.h>
+#include <vm.h>
+#include <coremap.h>
+#include <slab.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
@@ -102,23 +108,29 @@ static
 int
 common_prog(int nargs, char **args)
 {
-	int result;
+	int result, spl, exitcode;
 	struct thread * thread;
+	pid_t pid;
 
 #if OPT_SYNCHPROBS
 	kprintf("Warning: this probably won't work with a "
 		"synchronization-problems kernel.\n");
 #endif
 
+	/* Keep the child from running (and exiting) until we have its pid */
+	spl = splhigh();
 	result = thread_fork(args[0] /* thread name */,
 			args /* thread arg */, nargs /* thread arg */,
 			cmd_progthread, &thread);
 	if (result) {
+		splx(spl);
 		kprintf("thread_fork failed: %s\n", strerror(result));
 		return result;
 	}
+	pid = thread->t_proc->p_pid;
+	splx(spl);
 
-	return thread_join(thread);
+	return thread_join(pid, &exitcode);
 }
 
 /*
@@ -421,6 +433,128 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+#if OPT_KMALLOCTRACE
+static
+int
+cmd_khtrace(int nargs, char **args)
+{
+	if (nargs > 2 || (nargs == 2 && strcmp(args[1], "live"))) {
+		kprintf("Usage: khtrace [live]\n");
+		return EINVAL;
+	}
+
+	kheap_tracereport(nargs == 2);
+
+	return 0;
+}
+
+static
+int
+cmd_khmark(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kheap_tracemark();
+
+	return 0;
+}
+
+static
+int
+cmd_khleaks(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kheap_leakreport();
+
+	return 0;
+}
+#endif
+
+static
+int
+cmd_schedstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	scheduler_printstats();
+	proc_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_slabstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	slab_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_coremapstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	coremap_printstats();
+
+	return 0;
+}
+
+#if !OPT_DUMBVM
+static
+int
+cmd_vmstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vm_printstats();
+
+	return 0;
+}
+
+/*
+ * Command to choose the page replacement policy. Resets the paging
+ * counters, so the next run of a test program can be compared against
+ * the last one under a different policy.
+ */
+static
+int
+cmd_vmpolicy(int nargs, char **args)
+{
+	const char *name;
+	int i;
+
+	if (nargs != 2) {
+		kprintf("Usage: vmpolicy");
+		for (i=0; (name = coremap_getpolicy(i)) != NULL; i++) {
+			kprintf("%s%s", i ? "|" : " ", name);
+		}
+		kprintf("\n");
+		kprintf("Current policy is %s\n", coremap_getpolicy(-1));
+		return EINVAL;
+	}
+
+	if (coremap_setpolicy(args[1])) {
+		kprintf("vmpolicy: No such policy %s\n", args[1]);
+		return EINVAL;
+	}
+	vm_resetstats();
+
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -553,6 +687,18 @@ static const char *mainmenu[] = {
 	"[1c] Stoplight                      ",
 #endif
 	"[kh] Kernel heap stats              ",
+#if OPT_KMALLOCTRACE
+	"[khtrace [live]] Top kmalloc sites  ",
+	"[khmark] Start a kmalloc leak check ",
+	"[khleaks] kmalloc leaks since mark  ",
+#endif
+	"[slab] Slab cache stats             ",
+	"[sched] Scheduler and thread stats  ",
+	"[cm] Coremap stats                  ",
+#if !OPT_DUMBVM
+	"[vmstat] Paging stats               ",
+	"[vmpolicy] Set replacement policy   ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -609,6 +755,18 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+#if OPT_KMALLOCTRACE
+	{ "khtrace",	cmd_khtrace },
+	{ "khmark",	cmd_khmark },
+	{ "khleaks",	cmd_khleaks },
+#endif
+	{ "slab",       cmd_slabstats },
+	{ "sched",      cmd_schedstats },
+	{ "cm",         cmd_coremapstats },
+#if !OPT_DUMBVM
+	{ "vmstat",	cmd_vmstats },
+	{ "vmpolicy",	cmd_vmpolicy },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
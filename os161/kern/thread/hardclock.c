@@ -2,6 +2,7 @@
 #include <lib.h>
 #include <machine/spl.h>
 #include <thread.h>
+#include <scheduler.h>
 #include <clock.h>
 
 /* 
@@ -29,7 +30,9 @@ hardclock(void)
 		thread_wakeup(&lbolt);
 	}
 
-	thread_yield();
+	if (scheduler_tick()) {
+		thread_yield();
+	}
 }
 
 /*
@@ -0,0 +1,420 @@
+/*
+ * Processes. See proc.h.
+ */
+#include <types.h>
+#include <lib.h>
+#include <kern/errno.h>
+#include <kern/limits.h>
+#include <machine/spl.h>
+#include <thread.h>
+#include <curthread.h>
+#include <proc.h>
+#include <slab.h>
+
+struct proc *kernproc;
+
+static struct slab_cache proc_cache =
+	SLAB_CACHE("proc", sizeof(struct proc), NULL);
+
+/*
+ * Process table, indexed by pid.
+ *
+ * A pid stays taken as long as its process exists, zombie or not, so
+ * waitpid can't confuse an old child with a new one. Freed pids go on
+ * the end of a free list and new ones are taken from the front, so a
+ * pid isn't handed out again until all the other free ones have been.
+ *
+ * The table starts small and doubles whenever it runs out of free
+ * pids, up to PID_MAX; beyond that, the limit on the number of
+ * processes is just available memory.
+ */
+struct pidslot {
+	struct proc *ps_proc;
+	pid_t ps_nextfree;		/* free list link; 0 ends the list */
+};
+
+#define PIDTABLE_MINSIZE 32
+
+static struct pidslot *pidtable;
+static pid_t pidtable_size;
+static pid_t pidfree_head, pidfree_tail;
+
+/*
+ * Put PID on the end of the free list.
+ */
+static
+void
+pid_free(pid_t pid)
+{
+	assert(pid >= PID_MIN && pid < pidtable_size);
+
+	pidtable[pid].ps_proc = NULL;
+	pidtable[pid].ps_nextfree = 0;
+	if (pidfree_tail == 0) {
+		pidfree_head = pid;
+	}
+	else {
+		pidtable[pidfree_tail].ps_nextfree = pid;
+	}
+	pidfree_tail = pid;
+}
+
+/*
+ * Double the size of the process table.
+ */
+static
+int
+pidtable_grow(void)
+{
+	struct pidslot *newtable;
+	pid_t oldsize, newsize, pid;
+
+	oldsize = pidtable_size;
+	if (oldsize > PID_MAX) {
+		return EAGAIN;
+	}
+	newsize = oldsize == 0 ? PIDTABLE_MINSIZE : oldsize*2;
+	if (newsize > PID_MAX + 1) {
+		newsize = PID_MAX + 1;
+	}
+
+	newtable = kmalloc(newsize * sizeof(struct pidslot));
+	if (newtable == NULL) {
+		return ENOMEM;
+	}
+	if (pidtable_size != oldsize) {
+		/* Someone else grew it while kmalloc slept. */
+		kfree(newtable);
+		return 0;
+	}
+
+	if (oldsize > 0) {
+		memcpy(newtable, pidtable, oldsize * sizeof(struct pidslot));
+		kfree(pidtable);
+	}
+	pidtable = newtable;
+	pidtable_size = newsize;
+
+	for (pid = oldsize; pid < newsize; pid++) {
+		if (pid >= PID_MIN) {
+			pid_free(pid);
+		}
+		else {
+			pidtable[pid].ps_proc = NULL;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Give P a pid and enter it in the process table.
+ */
+static
+int
+pid_alloc(struct proc *p)
+{
+	pid_t pid;
+	int result;
+
+	while (pidfree_head == 0) {
+		result = pidtable_grow();
+		if (result) {
+			return result;
+		}
+	}
+
+	pid = pidfree_head;
+	pidfree_head = pidtable[pid].ps_nextfree;
+	if (pidfree_head == 0) {
+		pidfree_tail = 0;
+	}
+	pidtable[pid].ps_proc = p;
+	p->p_pid = pid;
+	return 0;
+}
+
+struct proc *
+proc_lookup(pid_t pid)
+{
+	assert(curspl>0);
+
+	if (pid < PID_MIN || pid >= pidtable_size) {
+		return NULL;
+	}
+	return pidtable[pid].ps_proc;
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Add P to the front of the list of siblings at HEAD.
+ */
+static
+void
+sib_add(struct proc **head, struct proc *p)
+{
+	p->p_prevsib = NULL;
+	p->p_nextsib = *head;
+	if (p->p_nextsib != NULL) {
+		p->p_nextsib->p_prevsib = p;
+	}
+	*head = p;
+}
+
+/*
+ * Take P off the list of siblings at HEAD.
+ */
+static
+void
+sib_remove(struct proc **head, struct proc *p)
+{
+	if (p->p_prevsib != NULL) {
+		p->p_prevsib->p_nextsib = p->p_nextsib;
+	}
+	else {
+		assert(*head == p);
+		*head = p->p_nextsib;
+	}
+	if (p->p_nextsib != NULL) {
+		p->p_nextsib->p_prevsib = p->p_prevsib;
+	}
+	p->p_nextsib = p->p_prevsib = NULL;
+}
+
+/*
+ * Make P, which is still running, a child of PARENT.
+ */
+static
+void
+proc_addchild(struct proc *parent, struct proc *p)
+{
+	assert(p->p_thread != NULL);
+
+	p->p_parent = parent;
+	sib_add(&parent->p_children, p);
+	if (!p->p_detached) {
+		parent->p_nwaitable++;
+	}
+}
+
+/*
+ * Take P, running or zombie, away from its parent.
+ */
+static
+void
+proc_removechild(struct proc *p)
+{
+	struct proc *parent = p->p_parent;
+
+	if (p->p_thread != NULL) {
+		sib_remove(&parent->p_children, p);
+	}
+	else {
+		sib_remove(&parent->p_zombies, p);
+	}
+	if (!p->p_detached) {
+		assert(parent->p_nwaitable > 0);
+		parent->p_nwaitable--;
+	}
+	p->p_parent = NULL;
+}
+
+/*
+ * Unlink P from its parent and free it and its pid.
+ */
+static
+void
+proc_free(struct proc *p)
+{
+	assert(p->p_children == NULL);
+	assert(p->p_zombies == NULL);
+	assert(p->p_thread == NULL);
+
+	if (p->p_parent != NULL) {
+		proc_removechild(p);
+	}
+	pid_free(p->p_pid);
+	slab_free(&proc_cache, p);
+}
+
+void
+proc_bootstrap(struct thread *first)
+{
+	struct proc *p;
+
+	p = slab_alloc(&proc_cache);
+	if (p == NULL || pid_alloc(p)) {
+		panic("proc_bootstrap: Out of memory\n");
+	}
+	p->p_parent = NULL;
+	p->p_children = NULL;
+	p->p_zombies = NULL;
+	p->p_nwaitable = 0;
+	p->p_nextsib = p->p_prevsib = NULL;
+	p->p_thread = first;
+	p->p_detached = 0;
+	p->p_exitcode = 0;
+
+	first->t_proc = p;
+	kernproc = p;
+}
+
+int
+proc_create(struct thread *t, int detached)
+{
+	struct proc *p;
+	int result;
+
+	assert(curspl>0);
+
+	p = slab_alloc(&proc_cache);
+	if (p == NULL) {
+		return ENOMEM;
+	}
+	result = pid_alloc(p);
+	if (result) {
+		slab_free(&proc_cache, p);
+		return result;
+	}
+
+	p->p_children = NULL;
+	p->p_zombies = NULL;
+	p->p_nwaitable = 0;
+	p->p_thread = t;
+	p->p_detached = detached;
+	p->p_exitcode = 0;
+	proc_addchild(curthread->t_proc, p);
+
+	t->t_proc = p;
+	return 0;
+}
+
+void
+proc_destroy(struct proc *p)
+{
+	assert(curspl>0);
+
+	proc_removechild(p);
+	p->p_thread->t_proc = NULL;
+	p->p_thread = NULL;
+	proc_free(p);
+}
+
+void
+proc_exit(struct proc *p, int exitcode)
+{
+	struct proc *child, *parent;
+
+	assert(curspl>0);
+	assert(p != kernproc);
+
+	/*
+	 * Nobody can wait for our children now. Free the ones that
+	 * have exited and give the rest to the kernel process, which
+	 * will let them go when they exit.
+	 */
+	while ((child = p->p_zombies) != NULL) {
+		proc_free(child);
+	}
+	while ((child = p->p_children) != NULL) {
+		proc_removechild(child);
+		child->p_detached = 1;
+		proc_addchild(kernproc, child);
+	}
+	assert(p->p_nwaitable == 0);
+
+	p->p_exitcode = exitcode;
+
+	if (p->p_detached) {
+		proc_removechild(p);
+		p->p_thread->t_proc = NULL;
+		p->p_thread = NULL;
+		proc_free(p);
+		return;
+	}
+
+	/* Become a zombie, and wake the parent if it's waiting. */
+	parent = p->p_parent;
+	sib_remove(&parent->p_children, p);
+	sib_add(&parent->p_zombies, p);
+	p->p_thread->t_proc = NULL;
+	p->p_thread = NULL;
+	thread_wakeup(parent);
+}
+
+/*
+ * Collect the exit code of zombie P, and free it.
+ */
+static
+void
+proc_reap(struct proc *p, pid_t *retpid, int *exitcode)
+{
+	*retpid = p->p_pid;
+	*exitcode = p->p_exitcode;
+	proc_free(p);
+}
+
+int
+proc_wait(pid_t pid, int nohang, pid_t *retpid, int *exitcode)
+{
+	struct proc *me = curthread->t_proc;
+	struct proc *p = NULL;
+
+	assert(curspl>0);
+
+	if (pid != -1) {
+		p = proc_lookup(pid);
+		if (p == NULL || p->p_parent != me || p->p_detached) {
+			return EINVAL;
+		}
+	}
+	else if (me->p_nwaitable == 0) {
+		return EINVAL;
+	}
+
+	/* Children wake us up when they exit. */
+	for (;;) {
+		if (p == NULL && me->p_zombies != NULL) {
+			proc_reap(me->p_zombies, retpid, exitcode);
+			return 0;
+		}
+		if (p != NULL && p->p_thread == NULL) {
+			proc_reap(p, retpid, exitcode);
+			return 0;
+		}
+		if (nohang) {
+			*retpid = 0;
+			return 0;
+		}
+		thread_sleep(me);
+	}
+}
+
+void
+proc_printstats(void)
+{
+	struct proc *p;
+	struct thread *t;
+	int i, spl;
+
+	spl = splhigh();
+	kprintf("  pid  ppid level  cputicks  name\n");
+	for (i = PID_MIN; i < pidtable_size; i++) {
+		p = pidtable[i].ps_proc;
+		if (p == NULL) {
+			continue;
+		}
+		t = p->p_thread;
+		if (t == NULL) {
+			kprintf("%5d %5d                   (zombie)\n", p->p_pid,
+				p->p_parent->p_pid);
+			continue;
+		}
+		kprintf("%5d %5d %5d %9u  %s%s\n", p->p_pid,
+			p->p_parent != NULL ? p->p_parent->p_pid : 0,
+			t->t_priority, t->t_cputicks, t->t_name,
+			t == curthread ? " (running)" :
+			t->t_sleepaddr != NULL ? " (asleep)" : "");
+	}
+	splx(spl);
+}
@@ -1,23 +1,92 @@
 /*
  * Scheduler.
  *
- * The default scheduler is very simple, just a round-robin run queue.
- * You'll want to improve it.
+ * This is a multilevel feedback queue. There are NPRIO run queues,
+ * 0 the most important; the scheduler always runs the first thread on
+ * the most important queue that has one. Each level has a quantum,
+ * longer for less important levels:
+ *
+ *    - A thread that uses up its whole quantum moves down a level.
+ *    - A thread that blocks (sleeps) before using it up moves up a
+ *      level when it wakes, so threads waiting on the console or the
+ *      disk get the CPU back quickly.
+ *    - Every BOOST_TICKS, every runnable thread is moved back up to
+ *      level 0, so CPU-bound threads can't be starved indefinitely.
+ *
+ * A thread that becomes runnable at a more important level than the
+ * one running preempts it at the next clock tick.
+ *
+ * The queues are linked through the thread structures, so nothing
+ * needs to be preallocated.
  */
 
 #include <types.h>
 #include <lib.h>
 #include <scheduler.h>
 #include <thread.h>
+#include <curthread.h>
+#include <clock.h>
 #include <machine/spl.h>
-#include <queue.h>
+#include <coremap.h>
 
 /*
  *  Scheduler data
  */
 
-// Queue of runnable threads
-static struct queue *runqueue;
+/* Quantum at each level, in hardclock ticks. */
+static const unsigned quantum[NPRIO] = { 1, 2, 4, 8 };
+
+/* How often everything is boosted back to level 0. */
+#define BOOST_TICKS  (HZ/2)
+
+// Queues of runnable threads
+static struct runqueue {
+	struct thread *rq_head;
+	struct thread *rq_tail;
+	unsigned rq_count;
+} runqueues[NPRIO];
+
+static unsigned boost_countdown = BOOST_TICKS;
+
+/* Statistics */
+static u_int32_t idle_ticks;
+static u_int32_t busy_ticks;
+static u_int32_t nboosts;
+static u_int32_t npreempts;
+
+static
+void
+rq_add(struct thread *t)
+{
+	struct runqueue *rq = &runqueues[t->t_priority];
+
+	t->t_runnext = NULL;
+	if (rq->rq_tail == NULL) {
+		rq->rq_head = t;
+	}
+	else {
+		rq->rq_tail->t_runnext = t;
+	}
+	rq->rq_tail = t;
+	rq->rq_count++;
+}
+
+static
+struct thread *
+rq_remhead(struct runqueue *rq)
+{
+	struct thread *t = rq->rq_head;
+
+	if (t != NULL) {
+		rq->rq_head = t->t_runnext;
+		if (rq->rq_head == NULL) {
+			rq->rq_tail = NULL;
+		}
+		t->t_runnext = NULL;
+		rq->rq_count--;
+	}
+	return t;
+}
 
 /*
  * Setup function
@@ -25,24 +94,26 @@ static struct queue *runqueue;
 void
 scheduler_bootstrap(void)
 {
-	runqueue = q_create(32);
-	if (runqueue == NULL) {
-		panic("scheduler: Could not create run queue\n");
+	int i;
+
+	for (i=0; i<NPRIO; i++) {
+		runqueues[i].rq_head = runqueues[i].rq_tail = NULL;
+		runqueues[i].rq_count = 0;
 	}
 }
 
 /*
  * Ensure space for handling at least NTHREADS threads.
  * This is done only to ensure that make_runnable() does not fail -
- * if you change the scheduler to not require space outside the 
- * thread structure, for instance, this function can reasonably
- * do nothing.
+ * since the run queues live in the thread structures, there's nothing
+ * to do.
  */
 int
 scheduler_preallocate(int nthreads)
 {
+	(void)nthreads;
 	assert(curspl>0);
-	return q_preallocate(runqueue, nthreads);
+	return 0;
 }
 
 /*
@@ -54,28 +125,27 @@ scheduler_preallocate(int nthreads)
 void
 scheduler_killall(void)
 {
+	struct thread *t;
+	int i;
+
 	assert(curspl>0);
-	while (!q_empty(runqueue)) {
-		struct thread *t = q_remhead(runqueue);
-		kprintf("scheduler: Dropping thread %s.\n", t->t_name);
+	for (i=0; i<NPRIO; i++) {
+		while ((t = rq_remhead(&runqueues[i])) != NULL) {
+			kprintf("scheduler: Dropping thread %s.\n", t->t_name);
+		}
 	}
 }
 
 /*
  * Cleanup function.
  *
- * The queue objects to being destroyed if it's got stuff in it.
- * Use scheduler_killall to make sure this is the case. During
- * ordinary shutdown, normally it should be.
+ * During ordinary shutdown the run queues should be empty already;
+ * anything left on them is dropped.
  */
 void
 scheduler_shutdown(void)
 {
 	scheduler_killall();
-
-	assert(curspl>0);
-	q_destroy(runqueue);
-	runqueue = NULL;
 }
 
 /*
@@ -83,30 +153,46 @@ scheduler_shutdown(void)
  * if there's nothing ready. (Note: cpu_idle must be called in a loop
  * until something's ready - it doesn't know whether the things that
  * wake it up are going to make a thread runnable or not.) 
+ *
+ * Before idling, the VM system gets a chance to wake its page-zeroing
+ * thread, so that work happens in time that would otherwise be wasted.
  */
 struct thread *
 scheduler(void)
 {
+	struct thread *t;
+	int i;
+
 	// meant to be called with interrupts off
 	assert(curspl>0);
-	
-	while (q_empty(runqueue)) {
-		cpu_idle();
-	}
 
-	// You can actually uncomment this to see what the scheduler's
-	// doing - even this deep inside thread code, the console
-	// still works. However, the amount of text printed is
-	// prohibitive.
-	// 
-	//print_run_queue();
-	
-	return q_remhead(runqueue);
+	for (;;) {
+		for (i=0; i<NPRIO; i++) {
+			t = rq_remhead(&runqueues[i]);
+			if (t != NULL) {
+				// You can actually uncomment this to see
+				// what the scheduler's doing - even this
+				// deep inside thread code, the console
+				// still works. However, the amount of text
+				// printed is prohibitive.
+				//
+				//print_run_queue();
+				return t;
+			}
+		}
+		if (!coremap_idle()) {
+			cpu_idle();
+		}
+	}
 }
 
 /* 
  * Make a thread runnable.
- * With the base scheduler, just add it to the end of the run queue.
+ *
+ * This is where threads change level. A thread coming out of
+ * thread_sleep still has its sleep address set: it blocked, so it
+ * moves up. A thread that has used up its quantum moves down. Either
+ * way it starts a fresh quantum.
  */
 int
 make_runnable(struct thread *t)
@@ -114,7 +200,104 @@ make_runnable(struct thread *t)
 	// meant to be called with interrupts off
 	assert(curspl>0);
 
-	return q_addtail(runqueue, t);
+	if (t->t_sleepaddr != NULL) {
+		if (t->t_priority > 0) {
+			t->t_priority--;
+		}
+		t->t_ticks = 0;
+	}
+	else if (t->t_ticks >= quantum[t->t_priority]) {
+		if (t->t_priority < NPRIO-1) {
+			t->t_priority++;
+		}
+		t->t_ticks = 0;
+	}
+
+	rq_add(t);
+	return 0;
+}
+
+/*
+ * Move every runnable thread, and the current one, up to level 0.
+ */
+static
+void
+scheduler_boost(void)
+{
+	struct thread *t;
+	int i;
+
+	for (i=1; i<NPRIO; i++) {
+		while ((t = rq_remhead(&runqueues[i])) != NULL) {
+			t->t_priority = 0;
+			t->t_ticks = 0;
+			rq_add(t);
+		}
+	}
+	if (curthread != NULL) {
+		curthread->t_priority = 0;
+		curthread->t_ticks = 0;
+	}
+	nboosts++;
+}
+
+/*
+ * Charge the current thread for a clock tick. Returns nonzero if it
+ * should give up the CPU: it has used up its quantum, or a thread at
+ * a more important level is waiting.
+ */
+int
+scheduler_tick(void)
+{
+	struct thread *t = curthread;
+	int i;
+
+	assert(curspl>0);
+
+	if (--boost_countdown == 0) {
+		boost_countdown = BOOST_TICKS;
+		scheduler_boost();
+	}
+
+	/* curthread is NULL while the scheduler is idling. */
+	if (t == NULL) {
+		idle_ticks++;
+		return 0;
+	}
+	busy_ticks++;
+
+	t->t_cputicks++;
+	t->t_ticks++;
+	if (t->t_ticks >= quantum[t->t_priority]) {
+		return 1;
+	}
+	for (i=0; i<t->t_priority; i++) {
+		if (runqueues[i].rq_head != NULL) {
+			npreempts++;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Print scheduler statistics.
+ */
+void
+scheduler_printstats(void)
+{
+	int spl = splhigh();
+	int i;
+
+	kprintf("Scheduler: %u ticks busy, %u idle, %u boosts, "
+		"%u preemptions\n", busy_ticks, idle_ticks, nboosts,
+		npreempts);
+	for (i=0; i<NPRIO; i++) {
+		kprintf("  level %d: quantum %u, %u runnable\n", i,
+			quantum[i], runqueues[i].rq_count);
+	}
+
+	splx(spl);
 }
 
 /*
@@ -126,14 +309,15 @@ print_run_queue(void)
 	/* Turn interrupts off so the whole list prints atomically. */
 	int spl = splhigh();
 
+	struct thread *t;
 	int i,k=0;
-	i = q_getstart(runqueue);
-	
-	while (i!=q_getend(runqueue)) {
-		struct thread *t = q_getguy(runqueue, i);
-		kprintf("  %2d: %s %p\n", k, t->t_name, t->t_sleepaddr);
-		i=(i+1)%q_getsize(runqueue);
-		k++;
+
+	for (i=0; i<NPRIO; i++) {
+		for (t = runqueues[i].rq_head; t != NULL; t = t->t_runnext) {
+			kprintf("  %2d: [%d] %s %p\n", k, i, t->t_name,
+				t->t_sleepaddr);
+			k++;
+		}
 	}
 	
 	splx(spl);
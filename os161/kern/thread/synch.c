@@ -8,12 +8,16 @@
 #include <synch.h>
 #include <thread.h>
 #include <curthread.h>
+#include <slab.h>
 #include <machine/spl.h>
 
 ////////////////////////////////////////////////////////////
 //
 // Semaphore.
 
+static struct slab_cache sem_cache =
+	SLAB_CACHE("semaphore", sizeof(struct semaphore), NULL);
+
 struct semaphore *
 sem_create(const char *namearg, int initial_count)
 {
@@ -21,14 +25,14 @@ sem_create(const char *namearg, int initial_count)
 
 	assert(initial_count >= 0);
 
-	sem = kmalloc(sizeof(struct semaphore));
+	sem = slab_alloc(&sem_cache);
 	if (sem == NULL) {
 		return NULL;
 	}
 
 	sem->name = kstrdup(namearg);
 	if (sem->name == NULL) {
-		kfree(sem);
+		slab_free(&sem_cache, sem);
 		return NULL;
 	}
 
@@ -56,7 +60,7 @@ sem_destroy(struct semaphore *sem)
 	 */
 
 	kfree(sem->name);
-	kfree(sem);
+	slab_free(&sem_cache, sem);
 }
 
 void 
@@ -74,11 +78,16 @@ P(struct semaphore *sem)
 	assert(in_interrupt==0);
 
 	spl = splhigh();
-	while (sem->count==0) {
+	if (sem->count > 0) {
+		sem->count--;
+	}
+	else {
+		/*
+		 * Only V wakes us, and it does so by handing us its
+		 * increment directly, so there's nothing to take.
+		 */
 		thread_sleep(sem);
 	}
-	assert(sem->count>0);
-	sem->count--;
 	splx(spl);
 }
 
@@ -88,9 +97,15 @@ V(struct semaphore *sem)
 	int spl;
 	assert(sem != NULL);
 	spl = splhigh();
-	sem->count++;
-	assert(sem->count>0);
-	thread_wakeup(sem);
+	/*
+	 * If anyone's waiting, give the increment straight to the one
+	 * that has waited longest, rather than waking them all to
+	 * fight over it.
+	 */
+	if (thread_single_wakeup(sem) == NULL) {
+		sem->count++;
+		assert(sem->count>0);
+	}
 	splx(spl);
 }
 
@@ -98,25 +113,30 @@ V(struct semaphore *sem)
 //
 // Lock.
 
+static struct slab_cache lock_cache =
+	SLAB_CACHE("lock", sizeof(struct lock), NULL);
+
 struct lock *
 lock_create(const char *name)
 {
 	struct lock *lock;
 
-	lock = kmalloc(sizeof(struct lock));
+	lock = slab_alloc(&lock_cache);
 	if (lock == NULL) {
 		return NULL;
 	}
 
 	lock->name = kstrdup(name);
 	if (lock->name == NULL) {
-		kfree(lock);
+		slab_free(&lock_cache, lock);
 		return NULL;
 	}
 	
 	// add stuff here as needed
 	// when the lock is created, no thread should be holding it.
 	lock->holding_thread = NULL;
+	lock->acquires = 0;
+	lock->contended = 0;
 	
 	return lock;
 }
@@ -133,8 +153,10 @@ lock_destroy(struct lock *lock)
 	spl = splhigh();
 	assert(thread_hassleepers(lock) == 0);
 	splx(spl);
+	DEBUG(DB_THREADS, "lock %s: %u acquires, %u contended\n",
+	      lock->name, lock->acquires, lock->contended);
 	kfree(lock->name);
-	kfree(lock);
+	slab_free(&lock_cache, lock);
 }
 
 void
@@ -146,13 +168,17 @@ lock_acquire(struct lock *lock)
 	int spl;
 	spl = splhigh();
 
-	// sleep threads trying to acquire the lock when the lock is being held by a thread
-	while (lock->holding_thread != NULL) {
-		thread_sleep(lock);
+	lock->acquires++;
+	if (lock->holding_thread == NULL) {
+		lock->holding_thread = curthread;
+	}
+	else {
+		// sleep until lock_release hands the lock to us
+		lock->contended++;
+		while (lock->holding_thread != curthread) {
+			thread_sleep(lock);
+		}
 	}
-	// there should be no thread holding the lock and let the current thread hold the lock
-	assert(lock->holding_thread == NULL);
-	lock->holding_thread = curthread;
 	splx(spl);
 }
 
@@ -167,10 +193,9 @@ lock_release(struct lock *lock)
 	assert(curthread == lock->holding_thread);
 	int spl;
 	spl = splhigh();
-	// unlock the lock (no thread is holding it anymore)
-	lock->holding_thread = NULL;
-	// wakeup all threads waiting for the lock to unlock
-	thread_wakeup(lock);
+	// hand the lock straight to the thread that has waited longest,
+	// if any, so only it wakes up, and nobody can cut in ahead of it
+	lock->holding_thread = thread_single_wakeup(lock);
 	splx(spl);
 }
 
@@ -185,20 +210,22 @@ lock_do_i_hold(struct lock *lock)
 //
 // CV
 
+static struct slab_cache cv_cache =
+	SLAB_CACHE("cv", sizeof(struct cv), NULL);
 
 struct cv *
 cv_create(const char *name)
 {
 	struct cv *cv;
 
-	cv = kmalloc(sizeof(struct cv));
+	cv = slab_alloc(&cv_cache);
 	if (cv == NULL) {
 		return NULL;
 	}
 
 	cv->name = kstrdup(name);
 	if (cv->name==NULL) {
-		kfree(cv);
+		slab_free(&cv_cache, cv);
 		return NULL;
 	}
 	
@@ -217,7 +244,7 @@ cv_destroy(struct cv *cv)
 	spl = splhigh();
 	assert(thread_hassleepers(cv) == 0);
 	kfree(cv->name);
-	kfree(cv);
+	slab_free(&cv_cache, cv);
     splx(spl);
 }
 
@@ -13,6 +13,9 @@
 #include <addrspace.h>
 #include <vnode.h>
 #include <synch.h>
+#include <slab.h>
+#include <proc.h>
+#include <file.h>
 #include "opt-synchprobs.h"
 
 /* States a thread can be in. */
@@ -27,21 +30,49 @@ typedef enum {
 /* Global variable for the thread currently executing at any given time. */
 struct thread *curthread;
 
-static struct array *thread_array;
-/* Table of sleeping threads. */
-static struct array *sleepers;
+/*
+ * Sleeping threads.
+ *
+ * The threads asleep on one address are kept, in the order they went
+ * to sleep, on a sleep queue for that address. Sleep queues are found
+ * by hashing the address, so waking the sleepers on an address costs
+ * time proportional to their number, not to the number of threads
+ * asleep altogether.
+ *
+ * Each thread owns a sleep queue structure while it's awake. A thread
+ * going to sleep on an address nobody else is sleeping on uses its
+ * own as the address's queue; otherwise it lends its own to the queue
+ * as a spare. A thread that's woken takes back a spare, or the queue
+ * itself if it was the last one on it. So going to sleep never needs
+ * to allocate memory.
+ */
+struct sleepq {
+	const void *sq_addr;
+	struct thread *sq_head;		/* first to sleep, first to wake */
+	struct thread *sq_tail;
+	struct sleepq *sq_next;		/* hash chain, or spares list */
+	struct sleepq *sq_spares;
+};
+
+#define SQ_NHASH 64
+#define SQ_HASH(addr) \
+	((((vaddr_t)(addr) >> 4) ^ ((vaddr_t)(addr) >> 12)) % SQ_NHASH)
+
+static struct sleepq *sleepqs[SQ_NHASH];
+
+static struct slab_cache sleepq_cache =
+	SLAB_CACHE("sleepq", sizeof(struct sleepq), NULL);
 
 /* List of dead threads to be disposed of. */
 static struct array *zombies;
 
+/* Thread structures. */
+static struct slab_cache thread_cache =
+	SLAB_CACHE("thread", sizeof(struct thread), NULL);
+
 /* Total number of outstanding threads. Does not count zombies[]. */
 static int numthreads;
 
-/* next pid value, TODO: may want to enable reuse of pids */
-static pid_t nextpid;
-
-static struct lock *pid_lock;
-
 
 
 /*
@@ -55,62 +86,117 @@ thread_count(void)
 }
 
 void print_sleepers() {
+	struct sleepq *sq;
+	struct thread *t;
 	int i;
-	int s = array_getnum(sleepers);
-	for(i = 0; i<s; i++) {
-		struct thread *t = array_getguy(sleepers, i);
-		kprintf("Thread %d sleeping...\n", t->pid);
+	for (i = 0; i < SQ_NHASH; i++) {
+		for (sq = sleepqs[i]; sq != NULL; sq = sq->sq_next) {
+			for (t = sq->sq_head; t != NULL; t = t->t_sleepnext) {
+				kprintf("Thread %s sleeping...\n", t->t_name);
+			}
+		}
 	}
 }
 
 
 
-/* methods to manipulate thread array (get by pid, add thread, remove by pid) */
-struct thread *
-get_thread_from_array(pid_t pid) {
-	int i;
-	for (i = 0; i < array_getnum(thread_array); i++) {
-		struct thread *t = array_getguy(thread_array, i);
-		if (t->pid == pid) {
-			return t;
+/*
+ * Find the sleep queue for ADDR, or NULL if nothing is asleep on it.
+ */
+static
+struct sleepq *
+sleepq_find(const void *addr)
+{
+	struct sleepq *sq;
+
+	for (sq = sleepqs[SQ_HASH(addr)]; sq != NULL; sq = sq->sq_next) {
+		if (sq->sq_addr == addr) {
+			return sq;
 		}
 	}
 	return NULL;
 }
 
+/*
+ * Put T, which is going to sleep on T->t_sleepaddr, at the end of the
+ * address's sleep queue. Interrupts must be off.
+ */
+static
+void
+sleepq_add(struct thread *t)
+{
+	struct sleepq *sq, *mine;
+	unsigned h;
 
-int
-add_thread_to_array(struct thread *t) {
+	assert(curspl>0);
 
-	int num_array_threads = array_getnum(thread_array);
-	int result = array_preallocate(thread_array, num_array_threads+1);
-	if (result) {
-		return -1;
+	mine = t->t_sleepq;
+	assert(mine != NULL);
+	t->t_sleepq = NULL;
+	t->t_sleepnext = NULL;
+
+	sq = sleepq_find(t->t_sleepaddr);
+	if (sq == NULL) {
+		sq = mine;
+		sq->sq_addr = t->t_sleepaddr;
+		sq->sq_head = sq->sq_tail = t;
+		sq->sq_spares = NULL;
+		h = SQ_HASH(sq->sq_addr);
+		sq->sq_next = sleepqs[h];
+		sleepqs[h] = sq;
+		return;
 	}
-	array_add(thread_array, t);
-	return 0;
+
+	mine->sq_next = sq->sq_spares;
+	sq->sq_spares = mine;
+	sq->sq_tail->t_sleepnext = t;
+	sq->sq_tail = t;
 }
 
-int
-remove_thread_from_array(pid_t pid) {
-	int i;
-	for (i = 0; i < array_getnum(thread_array); i++) {
-		struct thread *t = array_getguy(thread_array, i);
-		if (t->pid == pid) {
-			array_remove(thread_array, i);
-			return 0;
+/*
+ * Wake the first thread on SQ, handing it back a sleep queue. Returns
+ * SQ, or NULL if that was the last thread on it. Interrupts must be
+ * off.
+ */
+static
+struct sleepq *
+sleepq_wakeone(struct sleepq *sq)
+{
+	struct sleepq **sqp;
+	struct thread *t;
+	int result;
+
+	t = sq->sq_head;
+	assert(t != NULL);
+	sq->sq_head = t->t_sleepnext;
+	t->t_sleepnext = NULL;
+
+	if (sq->sq_head != NULL) {
+		t->t_sleepq = sq->sq_spares;
+		assert(t->t_sleepq != NULL);
+		sq->sq_spares = t->t_sleepq->sq_next;
+	}
+	else {
+		assert(sq->sq_spares == NULL);
+		for (sqp = &sleepqs[SQ_HASH(sq->sq_addr)]; *sqp != sq;
+		     sqp = &(*sqp)->sq_next) {
+			assert(*sqp != NULL);
 		}
+		*sqp = sq->sq_next;
+		sq->sq_addr = NULL;
+		sq->sq_tail = NULL;
+		t->t_sleepq = sq;
+		sq = NULL;
 	}
-	return -1;
-}
 
-void print_thread_array() {
-	int i;
-	int s = array_getnum(thread_array);
-	for(i = 0; i<s; i++) {
-		struct thread *t = array_getguy(thread_array, i);
-		kprintf("Thread exists with pid: %d\n", t->pid);
-	}
+	/*
+	 * Because we preallocate during thread_fork,
+	 * this should never fail.
+	 */
+	result = make_runnable(t);
+	assert(result==0);
+
+	return sq;
 }
 
 /*
@@ -123,16 +209,27 @@ struct thread *
 thread_create(const char *name)
 {
 	// lock_acquire(fork_lock);
-	struct thread *thread = kmalloc(sizeof(struct thread));
+	struct thread *thread = slab_alloc(&thread_cache);
 	if (thread==NULL) {
 		return NULL;
 	}
 	thread->t_name = kstrdup(name);
 	if (thread->t_name==NULL) {
-		kfree(thread);
+		slab_free(&thread_cache, thread);
+		return NULL;
+	}
+	thread->t_sleepq = slab_alloc(&sleepq_cache);
+	if (thread->t_sleepq==NULL) {
+		kfree(thread->t_name);
+		slab_free(&thread_cache, thread);
 		return NULL;
 	}
 	thread->t_sleepaddr = NULL;
+	thread->t_sleepnext = NULL;
+	thread->t_priority = 0;
+	thread->t_ticks = 0;
+	thread->t_cputicks = 0;
+	thread->t_runnext = NULL;
 	thread->t_stack = NULL;
 	
 	thread->t_vmspace = NULL;
@@ -142,24 +239,12 @@ thread_create(const char *name)
 	// If you add things to the thread structure, be sure to initialize
 	// them here.
 
-	/* assign this thread a pid, one thread at a time, protected by pid_lock */
-	lock_acquire(pid_lock);
-	thread->pid = nextpid;
-	nextpid++;
-	lock_release(pid_lock);
-	// if the thread created is not the first thread, set its parent to be the current thread
-	if (strcmp("<boot/menu>", name) != 0){
-		thread->ppid = curthread->pid;
-	}
-	else if(strcmp("<boot/menu>", name) == 0){
-		thread->ppid = -1;
-	}
+	/* the process is set up when the thread is started */
+	thread->t_proc = NULL;
+
+	/* file tables are set up by runprogram and fork */
+	thread->t_filetable = NULL;
 
-	thread->child_exit_codes = array_create();
-	if (thread->child_exit_codes == NULL) {
-		return NULL;
-	}
-	// kprintf("Created thread with pid %d, parent pid %d", thread->pid, thread->ppid);
 	return thread;
 }
 
@@ -183,6 +268,7 @@ thread_destroy(struct thread *thread)
 	// These things are cleaned up in thread_exit.
 	assert(thread->t_vmspace==NULL);
 	assert(thread->t_cwd==NULL);
+	assert(thread->t_filetable==NULL);
 	// kprintf("IN THREAD DESTROY");
 	if (thread->t_stack) {
 		kfree(thread->t_stack);
@@ -190,7 +276,11 @@ thread_destroy(struct thread *thread)
 
 	kfree(thread->t_name);
 
-	kfree(thread);
+	/* An exited thread has its sleep queue back. */
+	assert(thread->t_sleepq != NULL);
+	slab_free(&sleepq_cache, thread->t_sleepq);
+
+	slab_free(&thread_cache, thread);
 }
 
 
@@ -224,7 +314,9 @@ static
 void
 thread_killall(void)
 {
-	int i, result;
+	struct sleepq *sq;
+	struct thread *t;
+	int i;
 
 	assert(curspl>0);
 
@@ -233,9 +325,13 @@ thread_killall(void)
 	 * wake up while we're shutting down.
 	 */
 
-	for (i=0; i<array_getnum(sleepers); i++) {
-		struct thread *t = array_getguy(sleepers, i);
-		kprintf("sleep: Dropping thread %s\n", t->t_name);
+	for (i=0; i<SQ_NHASH; i++) {
+		for (sq = sleepqs[i]; sq != NULL; sq = sq->sq_next) {
+			for (t = sq->sq_head; t != NULL; t = t->t_sleepnext) {
+				kprintf("sleep: Dropping thread %s\n",
+					t->t_name);
+			}
+		}
 
 		/*
 		 * Don't do this: because these threads haven't
@@ -245,11 +341,8 @@ thread_killall(void)
 		 *
 		 * array_add(zombies, t);
 		 */
+		sleepqs[i] = NULL;
 	}
-
-	result = array_setsize(sleepers, 0);
-	/* shrinking array: not supposed to fail */
-	assert(result==0);
 }
 
 /*
@@ -273,27 +366,11 @@ thread_bootstrap(void)
 	struct thread *me;
 
 	/* Create the data structures we need. */
-	sleepers = array_create();
-	if (sleepers==NULL) {
-		panic("Cannot create sleepers array\n");
-	}
-
 	zombies = array_create();
 	if (zombies==NULL) {
 		panic("Cannot create zombies array\n");
 	}
 
-	/* create thread array */
-	thread_array = array_create();
-	if (thread_array == NULL) {
-		panic("Cannot create user thread array\n");
-	}
-
-	nextpid = 1;
-	pid_lock = lock_create("Pid Lock");
-	if (pid_lock == NULL) {
-		panic("Cannot create pid lock\n");
-	}
 	/*
 	 * Create the thread structure for the first thread
 	 * (the one that's already running)
@@ -311,7 +388,9 @@ thread_bootstrap(void)
 	/* Initialize the first thread's pcb */
 	md_initpcb0(&me->t_pcb);
 
-	add_thread_to_array(me);
+	/* Make it the kernel process */
+	proc_bootstrap(me);
+
 	/* Set curthread */
 	curthread = me;
 
@@ -328,12 +407,8 @@ thread_bootstrap(void)
 void
 thread_shutdown(void)
 {
-	array_destroy(sleepers);
-	sleepers = NULL;
 	array_destroy(zombies);
 	zombies = NULL;
-	array_destroy(thread_array);
-	thread_array = NULL;
 	// Don't do this - it frees our stack and we blow up
 	//thread_destroy(curthread);
 }
@@ -361,8 +436,9 @@ thread_fork(const char *name,
 	/* Allocate a stack */
 	newguy->t_stack = kmalloc(STACK_SIZE);
 	if (newguy->t_stack==NULL) {
+		slab_free(&sleepq_cache, newguy->t_sleepq);
 		kfree(newguy->t_name);
-		kfree(newguy);
+		slab_free(&thread_cache, newguy);
 		return ENOMEM;
 	}
 
@@ -384,39 +460,34 @@ thread_fork(const char *name,
 	/* Interrupts off for atomicity */
 	s = splhigh();
 
-	/* Allocate space for the new thread in thread array */
-	result = add_thread_to_array(newguy);
-	if (result) {
-		goto fail;
-	}
 	/*
 	 * Make sure our data structures have enough space, so we won't
 	 * run out later at an inconvenient time.
 	 */
-	result = array_preallocate(sleepers, numthreads+1);
-	if (result) {
-		remove_thread_from_array(newguy->pid);
-		goto fail;
-	}
 	result = array_preallocate(zombies, numthreads+1);
 	if (result) {
-		remove_thread_from_array(newguy->pid);
 		goto fail;
 	}
 
-
 	/* Do the same for the scheduler. */
 	result = scheduler_preallocate(numthreads+1);
 	if (result) {
-		remove_thread_from_array(newguy->pid);
 		goto fail;
 	}
 
+	/*
+	 * Give the new thread a process. If the caller doesn't want
+	 * the thread back, it can't wait for it either.
+	 */
+	result = proc_create(newguy, ret == NULL);
+	if (result) {
+		goto fail;
+	}
 
 	/* Make the new thread runnable */
 	result = make_runnable(newguy);
 	if (result != 0) {
-		remove_thread_from_array(newguy->pid);
+		proc_destroy(newguy->t_proc);
 		goto fail;
 	}
 
@@ -449,66 +520,28 @@ thread_fork(const char *name,
 		VOP_DECREF(newguy->t_cwd);
 	}
 	kfree(newguy->t_stack);
+	slab_free(&sleepq_cache, newguy->t_sleepq);
 	kfree(newguy->t_name);
-	kfree(newguy);
+	slab_free(&thread_cache, newguy);
 
 	return result;
 }
 
 /*
- * Suspend execution of curthread until thread terminates. 
- * Return zero on success, EDEADLK if deadlock would occur.
+ * Suspend execution of curthread until its child process PID exits,
+ * and collect its exit code. Returns an error code.
  */
-int thread_join(struct thread * child)
+int
+thread_join(pid_t pid, int *exitcode)
 {
-		pid_t pid = child->pid;
-		int spl = splhigh();
-		int i;
-		int *kernel_src = kmalloc(sizeof (int));
-		if (pid <= 0) {
-			splx(spl);
-			return -1;
-		}
-		if (child != NULL && child->ppid != curthread->pid) {
-			splx(spl);
-			return -1;
-		}
+	int result, spl;
+	pid_t retpid;
 
-		/* check exit codes to see if child exitted already, if so, copy code, remove code to avoid waiting for the same child again 
-		(case 3 of wait.c) and return 0 */
-		for (i = 0; i < array_getnum(curthread->child_exit_codes); i++) {
-			struct exitted_thread *e = array_getguy(curthread->child_exit_codes, i);
-			if (e->pid == pid) {
-				*kernel_src = e->exitcode;
-				/* remove this exit code */
-				array_remove(curthread->child_exit_codes, i);
-				splx(spl);
-				return 0;
-			} 
-		}
-		
-		/* if we could not find child exit code and could not find child pid in thread array,
-		then it means we are waiting for a non-existant thread (in wait test, this is case 3
-		where the parent is waiting for the child twice), return an error */
-		if (child == NULL) {
-			splx(spl);
-			return -1;
-		}
+	spl = splhigh();
+	result = proc_wait(pid, 0, &retpid, exitcode);
+	splx(spl);
 
-		thread_sleep(child);
-
-		for (i = 0; i < array_getnum(curthread->child_exit_codes); i++) {
-			struct exitted_thread *e = array_getguy(curthread->child_exit_codes, i);
-			if (e->pid == pid) {
-				*kernel_src = e->exitcode;
-				/* remove this exit code */
-				array_remove(curthread->child_exit_codes, i);
-				splx(spl);
-				return 0;
-			} 
-		}
-		panic("Should not get here in sys__waitpid, debug please!!");
-        return 0;
+	return result;
 }
 
 /*
@@ -558,11 +591,8 @@ mi_switch(threadstate_t nextstate)
 		result = make_runnable(cur);
 	}
 	else if (nextstate==S_SLEEP) {
-		/*
-		 * Because we preallocate sleepers[] during thread_fork,
-		 * this should never fail.
-		 */
-		result = array_add(sleepers, cur);
+		sleepq_add(cur);
+		result = 0;
 	}
 	else {
 		assert(nextstate==S_ZOMB);
@@ -639,29 +669,17 @@ thread_exit_with_code(int exitcode)
 		assert(curthread->t_stack[3] == (char)0x33);
 	}
 
-	splhigh();
-	if (curthread->ppid > 0) {
-		struct thread *parent = get_thread_from_array(curthread->ppid);
-		if (parent != NULL) {
-			// kprintf("ADDING EXITTED THREAD TO PARENT WITH PID: %d | By Child: %d", curthread->ppid, curthread->pid);
-			int num_codes = array_getnum(parent->child_exit_codes);
-			array_preallocate(parent->child_exit_codes, num_codes + 1);
-			struct exitted_thread *my_exit_code = kmalloc(sizeof (struct exitted_thread));
-			my_exit_code->pid = curthread->pid;
-			my_exit_code->exitcode = exitcode;
-			array_add(parent->child_exit_codes, my_exit_code);
-			remove_thread_from_array(curthread->pid);
-			int i;
-			for (i = 0; i < array_getnum(curthread->child_exit_codes); i++) {
-				kfree(array_getguy(curthread->child_exit_codes, i));
-			}
-			array_destroy(curthread->child_exit_codes);
-			curthread->child_exit_codes = NULL;
-			thread_single_wakeup(curthread);
-			// kprintf("FINISHED ADDING EXITTED THREAD TO PARENT WITH PID: %d", curthread->ppid);
-			// kprintf("NOW HAS NUM EXIT CODES: %d", array_getnum(parent->child_exit_codes));
-		}
+	/* Closing files may sleep, so do it while we still can. */
+	if (curthread->t_filetable) {
+		filetable_destroy(curthread->t_filetable);
+		curthread->t_filetable = NULL;
 	}
+
+	splhigh();
+
+	/* Leave the exit code for our parent, and wake it up */
+	proc_exit(curthread->t_proc, exitcode);
+
 	if (curthread->t_vmspace) {
 		/*
 		 * Do this carefully to avoid race condition with
@@ -692,8 +710,8 @@ thread_yield(void)
 {
 	int spl = splhigh();
 
-	/* Check sleepers just in case we get here after shutdown */
-	assert(sleepers != NULL);
+	/* Check zombies just in case we get here after shutdown */
+	assert(zombies != NULL);
 
 	mi_switch(S_READY);
 	splx(spl);
@@ -728,54 +746,36 @@ thread_sleep(const void *addr)
 void
 thread_wakeup(const void *addr)
 {
-	int i, result;
-	
+	struct sleepq *sq;
+
 	// meant to be called with interrupts off
 	assert(curspl>0);
-	
-	// This is inefficient. Feel free to improve it.
-	
-	for (i=0; i<array_getnum(sleepers); i++) {
-		struct thread *t = array_getguy(sleepers, i);
-		if (t->t_sleepaddr == addr) {
-			
-			// Remove from list
-			array_remove(sleepers, i);
-			
-			// must look at the same sleepers[i] again
-			i--;
-
-			/*
-			 * Because we preallocate during thread_fork,
-			 * this should never fail.
-			 */
-			result = make_runnable(t);
-			assert(result==0);
-		}
+
+	sq = sleepq_find(addr);
+	while (sq != NULL) {
+		sq = sleepq_wakeone(sq);
 	}
 }
 
 /*
  * Wake up strictly one thread who is sleeping on "sleep address" ADDR.
+ * Threads are woken in the order they went to sleep.
  */
-void 
+struct thread *
 thread_single_wakeup(const void *addr)
 {
-	int i, result;
+	struct sleepq *sq;
+	struct thread *t;
+
 	assert(curspl>0);
-	for (i=0; i<array_getnum(sleepers); i++) {
-		struct thread *t = array_getguy(sleepers, i);
-		if (t->t_sleepaddr == addr) {
-			
-			// Remove thread to be woken up from array
-			array_remove(sleepers, i);
-
-			// Make thread runnable (wake it up)
-			result = make_runnable(t);
-			assert(result==0);
-			return;
-		}
+
+	sq = sleepq_find(addr);
+	if (sq == NULL) {
+		return NULL;
 	}
+	t = sq->sq_head;
+	sleepq_wakeone(sq);
+	return t;
 }
 
 /*
@@ -785,18 +785,10 @@ thread_single_wakeup(const void *addr)
 int
 thread_hassleepers(const void *addr)
 {
-	int i;
-	
 	// meant to be called with interrupts off
 	assert(curspl>0);
-	
-	for (i=0; i<array_getnum(sleepers); i++) {
-		struct thread *t = array_getguy(sleepers, i);
-		if (t->t_sleepaddr == addr) {
-			return 1;
-		}
-	}
-	return 0;
+
+	return sleepq_find(addr) != NULL;
 }
 
 /*
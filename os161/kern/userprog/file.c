@@ -0,0 +1,248 @@
+/*
+ * Open files and file descriptor tables. See file.h.
+ */
+#include <types.h>
+#include <lib.h>
+#include <kern/errno.h>
+#include <kern/unistd.h>
+#include <machine/spl.h>
+#include <synch.h>
+#include <vfs.h>
+#include <file.h>
+#include <slab.h>
+
+static struct slab_cache openfile_cache =
+	SLAB_CACHE("openfile", sizeof(struct openfile), NULL);
+static struct slab_cache filetable_cache =
+	SLAB_CACHE("filetable", sizeof(struct filetable), NULL);
+
+/*
+ * Make an open file for vnode V, which has just been opened.
+ */
+static
+struct openfile *
+openfile_create(struct vnode *v, int flags)
+{
+	struct openfile *of;
+
+	of = slab_alloc(&openfile_cache);
+	if (of == NULL) {
+		return NULL;
+	}
+	of->of_lock = lock_create("openfile");
+	if (of->of_lock == NULL) {
+		slab_free(&openfile_cache, of);
+		return NULL;
+	}
+	of->of_vnode = v;
+	of->of_flags = flags;
+	of->of_offset = 0;
+	of->of_refcount = 1;
+	return of;
+}
+
+/*
+ * Add a descriptor's worth of reference to OF.
+ */
+static
+void
+openfile_incref(struct openfile *of)
+{
+	int spl;
+
+	spl = splhigh();
+	assert(of->of_refcount > 0);
+	of->of_refcount++;
+	splx(spl);
+}
+
+/*
+ * Drop a reference to OF, and close it if that was the last one.
+ */
+static
+void
+openfile_decref(struct openfile *of)
+{
+	unsigned refcount;
+	int spl;
+
+	spl = splhigh();
+	assert(of->of_refcount > 0);
+	refcount = --of->of_refcount;
+	splx(spl);
+
+	if (refcount == 0) {
+		vfs_close(of->of_vnode);
+		lock_destroy(of->of_lock);
+		slab_free(&openfile_cache, of);
+	}
+}
+
+/*
+ * Put OF on the lowest free descriptor of FT.
+ */
+static
+int
+filetable_place(struct filetable *ft, struct openfile *of, int *retfd)
+{
+	int fd;
+
+	for (fd = 0; fd < OPEN_MAX; fd++) {
+		if (ft->ft_files[fd] == NULL) {
+			ft->ft_files[fd] = of;
+			*retfd = fd;
+			return 0;
+		}
+	}
+	return EMFILE;
+}
+
+////////////////////////////////////////////////////////////
+
+struct filetable *
+filetable_create(void)
+{
+	struct filetable *ft;
+	int fd;
+
+	ft = slab_alloc(&filetable_cache);
+	if (ft == NULL) {
+		return NULL;
+	}
+	for (fd = 0; fd < OPEN_MAX; fd++) {
+		ft->ft_files[fd] = NULL;
+	}
+	return ft;
+}
+
+int
+filetable_copy(struct filetable *ft, struct filetable **ret)
+{
+	struct filetable *newft;
+	int fd;
+
+	newft = filetable_create();
+	if (newft == NULL) {
+		return ENOMEM;
+	}
+	for (fd = 0; fd < OPEN_MAX; fd++) {
+		if (ft->ft_files[fd] != NULL) {
+			openfile_incref(ft->ft_files[fd]);
+			newft->ft_files[fd] = ft->ft_files[fd];
+		}
+	}
+	*ret = newft;
+	return 0;
+}
+
+void
+filetable_destroy(struct filetable *ft)
+{
+	int fd;
+
+	for (fd = 0; fd < OPEN_MAX; fd++) {
+		if (ft->ft_files[fd] != NULL) {
+			openfile_decref(ft->ft_files[fd]);
+			ft->ft_files[fd] = NULL;
+		}
+	}
+	slab_free(&filetable_cache, ft);
+}
+
+int
+filetable_openstd(struct filetable *ft)
+{
+	/* vfs_open may scribble on the path, so each one gets its own */
+	char path[5];
+	int fd, retfd, result;
+
+	for (fd = STDIN_FILENO; fd <= STDERR_FILENO; fd++) {
+		assert(ft->ft_files[fd] == NULL);
+		strcpy(path, "con:");
+		result = file_open(ft, path,
+				   fd == STDIN_FILENO ? O_RDONLY : O_WRONLY,
+				   &retfd);
+		if (result) {
+			return result;
+		}
+		assert(retfd == fd);
+	}
+	return 0;
+}
+
+int
+file_open(struct filetable *ft, char *path, int flags, int *retfd)
+{
+	struct vnode *v;
+	struct openfile *of;
+	int result;
+
+	result = vfs_open(path, flags, &v);
+	if (result) {
+		return result;
+	}
+
+	of = openfile_create(v, flags);
+	if (of == NULL) {
+		vfs_close(v);
+		return ENOMEM;
+	}
+
+	result = filetable_place(ft, of, retfd);
+	if (result) {
+		openfile_decref(of);
+		return result;
+	}
+	return 0;
+}
+
+int
+file_get(struct filetable *ft, int fd, struct openfile **ret)
+{
+	if (fd < 0 || fd >= OPEN_MAX || ft->ft_files[fd] == NULL) {
+		return EBADF;
+	}
+	*ret = ft->ft_files[fd];
+	return 0;
+}
+
+int
+file_close(struct filetable *ft, int fd)
+{
+	struct openfile *of;
+	int result;
+
+	result = file_get(ft, fd, &of);
+	if (result) {
+		return result;
+	}
+	ft->ft_files[fd] = NULL;
+	openfile_decref(of);
+	return 0;
+}
+
+int
+file_dup2(struct filetable *ft, int oldfd, int newfd)
+{
+	struct openfile *of, *old;
+	int result;
+
+	result = file_get(ft, oldfd, &of);
+	if (result) {
+		return result;
+	}
+	if (newfd < 0 || newfd >= OPEN_MAX) {
+		return EBADF;
+	}
+	if (oldfd == newfd) {
+		return 0;
+	}
+
+	openfile_incref(of);
+	old = ft->ft_files[newfd];
+	ft->ft_files[newfd] = of;
+	if (old != NULL) {
+		openfile_decref(old);
+	}
+	return 0;
+}
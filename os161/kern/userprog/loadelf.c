@@ -1,11 +1,11 @@
 /*
  * Code to load an ELF-format executable into the current address space.
  *
- * Right now it just copies into userspace and hopes the addresses are
- * mappable to real memory. This works with dumbvm; however, when you
- * write a real VM system, you will need to either (1) add code that 
- * makes the address range used for load valid, or (2) if you implement
- * memory-mapped files, map each segment instead of copying it into RAM.
+ * With dumbvm, each segment is copied into memory allocated up front.
+ * The paging VM instead maps each segment from the file, and vm_fault
+ * reads in (or zero-fills) each page the first time it's touched.
+ * Segments that can't be mapped that way are copied in as with dumbvm,
+ * except that their bss is left to vm_fault.
  */
 
 #include <types.h>
@@ -71,16 +71,47 @@ load_segment(struct vnode *v, off_t offset, vaddr_t vaddr,
 
 	/* Fill the rest of the memory space (if any) with zeros */
 	fillamt = memsize - filesize;
+#if OPT_DUMBVM
 	if (fillamt > 0) {
 		DEBUG(DB_EXEC, "ELF: Zero-filling %lu more bytes\n", 
 		      (unsigned long) fillamt);
 		u.uio_resid += fillamt;
 		result = uiomovezeros(fillamt, &u);
 	}
+#else
+	/*
+	 * vm_fault hands out zero-filled pages, so the bss is already
+	 * zero. Writing zeros here would just commit every bss page.
+	 */
+	DEBUG(DB_EXEC, "ELF: Leaving %lu bytes of bss to demand zero\n",
+	      (unsigned long) fillamt);
+#endif
 	
 	return result;
 }
 
+/*
+ * Check a program header. Returns 0 if the segment is to be loaded,
+ * -1 if it should be skipped, or an error code.
+ */
+static
+int
+check_phdr(const Elf_Phdr *ph)
+{
+	switch (ph->p_type) {
+	    case PT_NULL: /* skip */ return -1;
+	    case PT_PHDR: /* skip */ return -1;
+	    case PT_MIPS_REGINFO: /* skip */ return -1;
+	    case PT_LOAD:
+		/* An empty segment has nothing to map or load. */
+		return ph->p_memsz == 0 ? -1 : 0;
+	    default:
+		kprintf("loadelf: unknown segment type %d\n", 
+			ph->p_type);
+		return ENOEXEC;
+	}
+}
+
 /*
  * Load an ELF executable user program into the current address space.
  *
@@ -91,8 +122,13 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 {
 	Elf_Ehdr eh;   /* Executable header */
 	Elf_Phdr ph;   /* "Program header" = segment header */
+	char *phdrs;   /* All the program headers, as read from the file */
+	size_t phsize;
 	int result, i;
 	struct uio ku;
+#if !OPT_DUMBVM
+	struct region *rg;
+#endif
 
 	/*
 	 * Read the executable header from offset 0 in the file.
@@ -135,12 +171,8 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	}
 
 	/*
-	 * Go through the list of segments and set up the address space.
-	 *
-	 * Ordinarily there will be one code segment, one read-only
-	 * data segment, and one data/bss segment, but there might
-	 * conceivably be more. You don't need to support such files
-	 * if it's unduly awkward to do so.
+	 * Read all the program headers at once; both passes below need
+	 * them.
 	 *
 	 * Note that the expression eh.e_phoff + i*eh.e_phentsize is 
 	 * mandated by the ELF standard - we use sizeof(ph) to load,
@@ -149,31 +181,72 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	 * to find where the phdr starts.
 	 */
 
+	if (eh.e_phnum > 0 && eh.e_phentsize < sizeof(ph)) {
+		return ENOEXEC;
+	}
+	phsize = eh.e_phnum * eh.e_phentsize;
+	phdrs = kmalloc(phsize > 0 ? phsize : 1);
+	if (phdrs == NULL) {
+		return ENOMEM;
+	}
+
+	mk_kuio(&ku, phdrs, phsize, eh.e_phoff, UIO_READ);
+	result = VOP_READ(v, &ku);
+	if (result) {
+		goto done;
+	}
+
+	if (ku.uio_resid != 0) {
+		/* short read; problem with executable? */
+		kprintf("ELF: short read on phdr - file truncated?\n");
+		result = ENOEXEC;
+		goto done;
+	}
+
+	/*
+	 * Go through the list of segments and set up the address space.
+	 *
+	 * Ordinarily there will be one code segment, one read-only
+	 * data segment, and one data/bss segment, but there might
+	 * conceivably be more. You don't need to support such files
+	 * if it's unduly awkward to do so.
+	 */
+
 	for (i=0; i<eh.e_phnum; i++) {
-		off_t offset = eh.e_phoff + i*eh.e_phentsize;
-		mk_kuio(&ku, &ph, sizeof(ph), offset, UIO_READ);
+		memcpy(&ph, phdrs + i*eh.e_phentsize, sizeof(ph));
 
-		result = VOP_READ(v, &ku);
-		if (result) {
-			return result;
+		result = check_phdr(&ph);
+		if (result < 0) {
+			continue;
 		}
-
-		if (ku.uio_resid != 0) {
-			/* short read; problem with executable? */
-			kprintf("ELF: short read on phdr - file truncated?\n");
-			return ENOEXEC;
+		if (result) {
+			goto done;
 		}
 
-		switch (ph.p_type) {
-		    case PT_NULL: /* skip */ continue;
-		    case PT_PHDR: /* skip */ continue;
-		    case PT_MIPS_REGINFO: /* skip */ continue;
-		    case PT_LOAD: break;
-		    default:
-			kprintf("loadelf: unknown segment type %d\n", 
-				ph.p_type);
-			return ENOEXEC;
+#if !OPT_DUMBVM
+		/*
+		 * Map segments straight from the file, so that nothing
+		 * is read until it's used, and everyone running this
+		 * program shares one copy of the parts nobody writes.
+		 * If the segment doesn't line up with pages in the file,
+		 * or shares a page with another segment, load it the
+		 * ordinary way instead.
+		 */
+		if (ph.p_filesz > 0 && ph.p_filesz <= ph.p_memsz) {
+			result = as_define_file(curthread->t_vmspace,
+						ph.p_vaddr, ph.p_memsz,
+						v, ph.p_offset, ph.p_filesz,
+						ph.p_flags & PF_R,
+						ph.p_flags & PF_W,
+						ph.p_flags & PF_X);
+			if (result != EINVAL) {
+				if (result) {
+					goto done;
+				}
+				continue;
+			}
 		}
+#endif
 
 		result = as_define_region(curthread->t_vmspace,
 					  ph.p_vaddr, ph.p_memsz,
@@ -181,13 +254,13 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 					  ph.p_flags & PF_W,
 					  ph.p_flags & PF_X);
 		if (result) {
-			return result;
+			goto done;
 		}
 	}
 
 	result = as_prepare_load(curthread->t_vmspace);
 	if (result) {
-		return result;
+		goto done;
 	}
 
 	/*
@@ -195,45 +268,37 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	 */
 
 	for (i=0; i<eh.e_phnum; i++) {
-		off_t offset = eh.e_phoff + i*eh.e_phentsize;
-		mk_kuio(&ku, &ph, sizeof(ph), offset, UIO_READ);
+		memcpy(&ph, phdrs + i*eh.e_phentsize, sizeof(ph));
 
-		result = VOP_READ(v, &ku);
-		if (result) {
-			return result;
-		}
-
-		if (ku.uio_resid != 0) {
-			/* short read; problem with executable? */
-			kprintf("ELF: short read on phdr - file truncated?\n");
-			return ENOEXEC;
+		if (check_phdr(&ph) != 0) {
+			/* Bad ones were already rejected above. */
+			continue;
 		}
 
-		switch (ph.p_type) {
-		    case PT_NULL: /* skip */ continue;
-		    case PT_PHDR: /* skip */ continue;
-		    case PT_MIPS_REGINFO: /* skip */ continue;
-		    case PT_LOAD: break;
-		    default:
-			kprintf("loadelf: unknown segment type %d\n", 
-				ph.p_type);
-			return ENOEXEC;
+#if !OPT_DUMBVM
+		/* File-backed segments are paged in on demand. */
+		rg = as_getregion(curthread->t_vmspace, ph.p_vaddr);
+		if (rg != NULL && rg->rg_obj != NULL) {
+			continue;
 		}
+#endif
 
 		result = load_segment(v, ph.p_offset, ph.p_vaddr, 
 				      ph.p_memsz, ph.p_filesz,
 				      ph.p_flags & PF_X);
 		if (result) {
-			return result;
+			goto done;
 		}
 	}
 
 	result = as_complete_load(curthread->t_vmspace);
 	if (result) {
-		return result;
+		goto done;
 	}
 
 	*entrypoint = eh.e_entry;
 
-	return 0;
+ done:
+	kfree(phdrs);
+	return result;
 }
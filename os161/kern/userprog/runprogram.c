@@ -17,6 +17,7 @@
 #include <vm.h>
 #include <vfs.h>
 #include <test.h>
+#include <file.h>
 #include <syscall.h>
 
 /*
@@ -289,7 +290,23 @@ runprogram_with_args(char *program, char ** args, int nargs, int *err)
 int 
 runprogram(char *progname, char ** args, int nargs) {
 	int result;
-	as_destroy(curthread->t_vmspace);
+
+	/* A new program starts with the console on stdin, stdout and stderr. */
+	if (curthread->t_filetable == NULL) {
+		curthread->t_filetable = filetable_create();
+		if (curthread->t_filetable == NULL) {
+			return ENOMEM;
+		}
+		result = filetable_openstd(curthread->t_filetable);
+		if (result) {
+			return result;
+		}
+	}
+
+	if (curthread->t_vmspace != NULL) {
+		as_destroy(curthread->t_vmspace);
+		curthread->t_vmspace = NULL;
+	}
 	if (args == NULL) {
 		result = runprogram_without_args(progname);
 		return result;
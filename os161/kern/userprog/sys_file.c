@@ -0,0 +1,196 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/unistd.h>
+#include <kern/limits.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <machine/trapframe.h>
+#include <syscall.h>
+#include <curthread.h>
+#include <thread.h>
+#include <synch.h>
+#include <vnode.h>
+#include <file.h>
+#include <vm.h>
+#include <vmobj.h>
+
+/*
+OPEN
+****Description****
+open opens the file, device, or other kernel object named by the
+pathname FILENAME. FLAGS specifies how to open the file: one of
+O_RDONLY, O_WRONLY and O_RDWR, or'd with any of O_CREAT, O_EXCL,
+O_TRUNC and O_APPEND. The new descriptor is the lowest one not in use,
+and its seek position starts at 0.
+
+****Errors****
+ENOENT	The named file does not exist, and O_CREAT was not specified.
+EEXIST	The named file exists, and O_EXCL was specified.
+EISDIR	The named object is a directory, and it was to be opened for
+	writing.
+EMFILE	The process's file table is full.
+EINVAL	FLAGS contained invalid values.
+EFAULT	FILENAME was an invalid pointer.
+*/
+int
+sys_open(const char *filename, int flags, int32_t *retval)
+{
+	char *path;
+	int fd, result;
+
+	if (curthread->t_filetable == NULL) {
+		return EMFILE;
+	}
+	if ((flags & O_ACCMODE) == O_ACCMODE ||
+	    (flags & ~(O_ACCMODE|O_CREAT|O_EXCL|O_TRUNC|O_APPEND)) != 0) {
+		return EINVAL;
+	}
+
+	path = kmalloc(PATH_MAX);
+	if (path == NULL) {
+		return ENOMEM;
+	}
+	result = copyinstr((const_userptr_t)filename, path, PATH_MAX, NULL);
+	if (result == 0) {
+		result = file_open(curthread->t_filetable, path, flags, &fd);
+	}
+	kfree(path);
+	if (result) {
+		return result;
+	}
+	*retval = fd;
+	return 0;
+}
+
+/*
+CLOSE
+****Description****
+close closes the descriptor FD. The open file it names is closed too
+once no other descriptor, in this or any other process, names it.
+
+****Errors****
+EBADF	FD is not a valid descriptor.
+*/
+int
+sys_close(int fd)
+{
+	if (curthread->t_filetable == NULL) {
+		return EBADF;
+	}
+	return file_close(curthread->t_filetable, fd);
+}
+
+/*
+LSEEK
+****Description****
+lseek moves the seek position of the file named by FD. WHENCE says
+what POS is relative to: the start of the file (SEEK_SET), the current
+position (SEEK_CUR), or the end of the file (SEEK_END). Returns the new
+position.
+
+****Errors****
+EBADF	FD is not a valid descriptor.
+ESPIPE	FD names a device or other object that can't seek.
+EINVAL	WHENCE is invalid, or the resulting position would be negative.
+*/
+int
+sys_lseek(int fd, off_t pos, int whence, int32_t *retval)
+{
+	struct openfile *of;
+	struct stat st;
+	int result;
+
+	if (curthread->t_filetable == NULL) {
+		return EBADF;
+	}
+	result = file_get(curthread->t_filetable, fd, &of);
+	if (result) {
+		return result;
+	}
+
+	lock_acquire(of->of_lock);
+	switch (whence) {
+	    case SEEK_SET:
+		break;
+	    case SEEK_CUR:
+		pos += of->of_offset;
+		break;
+	    case SEEK_END:
+		result = VOP_STAT(of->of_vnode, &st);
+		pos += st.st_size;
+		break;
+	    default:
+		result = EINVAL;
+		break;
+	}
+	if (result == 0 && pos < 0) {
+		result = EINVAL;
+	}
+	if (result == 0) {
+		result = VOP_TRYSEEK(of->of_vnode, pos);
+	}
+	if (result == 0) {
+		of->of_offset = pos;
+		*retval = pos;
+	}
+	lock_release(of->of_lock);
+	return result;
+}
+
+/*
+DUP2
+****Description****
+dup2 makes NEWFD name the same open file as OLDFD, closing the file
+NEWFD named first, if any. The two descriptors then share a seek
+position. Returns NEWFD.
+
+****Errors****
+EBADF	OLDFD is not a valid descriptor, or NEWFD is out of range.
+*/
+int
+sys_dup2(int oldfd, int newfd, int32_t *retval)
+{
+	int result;
+
+	if (curthread->t_filetable == NULL) {
+		return EBADF;
+	}
+	result = file_dup2(curthread->t_filetable, oldfd, newfd);
+	if (result) {
+		return result;
+	}
+	*retval = newfd;
+	return 0;
+}
+
+/*
+FSYNC
+****Description****
+fsync writes everything the kernel has buffered for the file named by
+FD out to disk, including pages written through MAP_SHARED mappings.
+
+****Errors****
+EBADF	FD is not a valid descriptor.
+EIO	A hardware I/O error occurred.
+*/
+int
+sys_fsync(int fd)
+{
+	struct openfile *of;
+	int result;
+
+	if (curthread->t_filetable == NULL) {
+		return EBADF;
+	}
+	result = file_get(curthread->t_filetable, fd, &of);
+	if (result) {
+		return result;
+	}
+#if !OPT_DUMBVM
+	result = vmobj_syncvnode(of->of_vnode);
+	if (result) {
+		return result;
+	}
+#endif
+	return VOP_FSYNC(of->of_vnode);
+}
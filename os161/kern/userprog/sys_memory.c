@@ -0,0 +1,133 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/unistd.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <machine/trapframe.h>
+#include <syscall.h>
+#include <curthread.h>
+#include <thread.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <file.h>
+
+/*
+SBRK
+****Description****
+The "break" is the end address of a process's heap region. sbrk moves
+the break by CHANGE bytes, which may be negative, and returns the old
+break. Pages are only given memory when first touched, and pages
+released by a negative CHANGE are freed at once.
+
+****Errors****
+ENOMEM	Sufficient virtual memory to satisfy the request was not available.
+EINVAL	The request would move the break below its initial value.
+*/
+int
+sys_sbrk(intptr_t change, int32_t *retval)
+{
+#if OPT_DUMBVM
+	/* dumbvm's address spaces have a fixed layout. */
+	(void)change;
+	(void)retval;
+	return ENOSYS;
+#else
+	vaddr_t oldbreak;
+	int result;
+
+	result = as_sbrk(curthread->t_vmspace, change, &oldbreak);
+	if (result) {
+		return result;
+	}
+	*retval = (int32_t)oldbreak;
+	return 0;
+#endif
+}
+
+/*
+MMAP
+****Description****
+mmap maps LEN bytes of the file open as FD, starting at OFFSET, into
+the process's address space, and returns where. ADDR is only a hint,
+and is ignored. Pages are read from the file when first touched. With
+MAP_SHARED, the pages are the ones every other mapping of the file
+uses, and writes to them go back to the file on munmap or exit; with
+MAP_PRIVATE, the process gets a copy of a page when it writes to it.
+
+****Errors****
+EBADF	FD is not a valid file handle, or isn't open for reading, or
+	PROT_WRITE and MAP_SHARED were asked for and it isn't open for
+	writing.
+EINVAL	LEN is 0, OFFSET is not page-aligned, FLAGS is not one of
+	MAP_SHARED and MAP_PRIVATE, or PROT has PROT_WRITE without
+	PROT_READ.
+ENODEV	The file is a device, which can't be mapped.
+ENOMEM	There isn't enough free address space for the mapping, or LEN
+	is larger than the whole user address space.
+*/
+int
+sys_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset,
+	 int32_t *retval)
+{
+#if OPT_DUMBVM
+	(void)addr;
+	(void)len;
+	(void)prot;
+	(void)flags;
+	(void)fd;
+	(void)offset;
+	(void)retval;
+	return ENOSYS;
+#else
+	struct openfile *of;
+	vaddr_t vaddr;
+	int how, result;
+
+	(void)addr;
+
+	if (curthread->t_filetable == NULL) {
+		return EBADF;
+	}
+	result = file_get(curthread->t_filetable, fd, &of);
+	if (result) {
+		return result;
+	}
+
+	/* Shared writeable mappings write to the file, so need O_RDWR. */
+	how = of->of_flags & O_ACCMODE;
+	if (how == O_WRONLY ||
+	    (how == O_RDONLY && (prot & PROT_WRITE) && flags == MAP_SHARED)) {
+		return EBADF;
+	}
+
+	result = as_mmap(curthread->t_vmspace, len, of->of_vnode, offset, prot,
+			 flags, &vaddr);
+	if (result) {
+		return result;
+	}
+	*retval = (int32_t)vaddr;
+	return 0;
+#endif
+}
+
+/*
+MUNMAP
+****Description****
+munmap removes a mapping made by mmap. ADDR must be the address mmap
+returned, and LEN the length it was given. Changes made through a
+MAP_SHARED mapping are written back to the file.
+
+****Errors****
+EINVAL	ADDR and LEN are not those of a mapping.
+*/
+int
+sys_munmap(void *addr, size_t len)
+{
+#if OPT_DUMBVM
+	(void)addr;
+	(void)len;
+	return ENOSYS;
+#else
+	return as_munmap(curthread->t_vmspace, (vaddr_t)addr, len);
+#endif
+}
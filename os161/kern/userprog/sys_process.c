@@ -9,15 +9,22 @@
 #include <syscall.h>
 #include <curthread.h>
 #include <thread.h>
+#include <proc.h>
 #include <synch.h>
 #include <addrspace.h>
 #include <array.h>
 #include <vm.h>
 #include <vfs.h>
 #include <test.h>
+#include <slab.h>
+#include <file.h>
 
 
 int debug = 0;
+
+/* Copies of the parent's trapframe, passed to the child by sys_fork. */
+static struct slab_cache trapframe_cache =
+	SLAB_CACHE("trapframe", sizeof(struct trapframe), NULL);
 /*
 FORK
 ****Description****
@@ -76,6 +83,7 @@ md_forkentry(void *tf, unsigned long addrspace)
 
     // kprintf("BEFORE MEM CPY");
     tf_child_stack = *tf_child;
+    slab_free(&trapframe_cache, tf_child);
     // kprintf("TRAP FRAME CHILD STACK PC: %d\n", tf_child_stack.tf_epc);
 
     /* set v0 (return 0), set a3 (signal no error), set epc (increment pc by 4) */
@@ -87,7 +95,7 @@ md_forkentry(void *tf, unsigned long addrspace)
 
     mips_usermode(&tf_child_stack);
 
-    kprintf("CHILD THREAD WITH PID: %d FINISHED EXECUTING MIPS USER MODE AND RETURNED TO MD FORK ENTRY!!", curthread->pid);
+    kprintf("CHILD THREAD WITH PID: %d FINISHED EXECUTING MIPS USER MODE AND RETURNED TO MD FORK ENTRY!!", curthread->t_proc->p_pid);
     assert(0);
 }
 
@@ -98,20 +106,16 @@ sys_fork(struct trapframe *tf, int *err) {
     /* The trap frame is supposed to be 37 registers long. */
 	assert(sizeof *tf == (37*4));
 
-    if(thread_count() > MAX_THREADS) {
-        // lock_release(fork_lock);
-        *err = EAGAIN;
-        return -1;
-    }
-
     struct trapframe *tf_child;
     struct addrspace *addr_child;
     struct thread *thread_child;
-     
+    struct filetable *ft_child = NULL;
+    pid_t pid;
+    int result, spl;
 
 
     /* make a copy of the parent trapframe to be used by the child */
-    tf_child = kmalloc(sizeof (struct trapframe));
+    tf_child = slab_alloc(&trapframe_cache);
     if(tf_child == NULL) {
         *err = ENOMEM;
         return -1;
@@ -119,108 +123,81 @@ sys_fork(struct trapframe *tf, int *err) {
     memmove(tf_child, tf, sizeof (struct trapframe));
 
     /* make a copy of the parent address space to be used by the child */
-    addr_child = kmalloc(sizeof (struct addrspace));
-    if (addr_child == NULL){
-        kfree(tf_child);
-        *err = ENOMEM;
+    result = as_copy(curthread->t_vmspace, &addr_child);
+    if (result) {
+        slab_free(&trapframe_cache, tf_child);
+        *err = result;
         return -1;
     }
-    as_copy(curthread->t_vmspace, &addr_child);
-    if (addr_child == NULL) {
-        kfree(tf_child);
-        *err = ENOMEM;
-        return -1;
+
+    /* the child gets its own file table, naming the same open files */
+    if (curthread->t_filetable != NULL) {
+        result = filetable_copy(curthread->t_filetable, &ft_child);
+        if (result) {
+            slab_free(&trapframe_cache, tf_child);
+            as_destroy(addr_child);
+            *err = result;
+            return -1;
+        }
     }
     
     /* pass tf, addrspace, md_forkentry into thread_fork which creates a thread and calls md_forkentry
         with tf as first argument, addrspace as second argument */
-    thread_fork("User Thread Fork", (void *) tf_child, (unsigned long) addr_child, md_forkentry, &thread_child);
-    if (thread_child == NULL) {
-        kfree(tf_child);
-        kfree(addr_child);
-        *err = ENOMEM;
+    /* keep the child from running (and exiting) until we have its pid */
+    spl = splhigh();
+    result = thread_fork("User Thread Fork", (void *) tf_child, (unsigned long) addr_child, md_forkentry, &thread_child);
+    if (result) {
+        splx(spl);
+        if (ft_child != NULL) {
+            filetable_destroy(ft_child);
+        }
+        slab_free(&trapframe_cache, tf_child);
+        as_destroy(addr_child);
+        *err = result;
         return -1;
     }
-    return thread_child->pid;
+    thread_child->t_filetable = ft_child;
+    pid = thread_child->t_proc->p_pid;
+    splx(spl);
+    return pid;
 }
 
 pid_t
 sys_getpid() {
-    return curthread->pid;
+    return curthread->t_proc->p_pid;
 }
 
 
 pid_t
 sys_waitpid(pid_t pid, int *status, int options, int *err) {
-    int spl = splhigh();
-    int i;
-    int *kernel_src = kmalloc(sizeof (int));
-    int copy_err = 0;
-    struct thread *child = get_thread_from_array(pid);
-    if (pid <= 0) {
-        *err = EINVAL;
-        splx(spl);
-        return -1;
-    }
-    if (child != NULL && child->ppid != curthread->pid) {
-        *err = EINVAL;
-        splx(spl);
-        return -1;
-    }
-    if (options != 0) {
+    pid_t retpid;
+    int exitcode;
+    int result, spl;
+
+    /* pid -1 means any child */
+    if ((pid <= 0 && pid != -1) || (options & ~WNOHANG) != 0) {
         *err = EINVAL;
-        splx(spl);
         return -1;
     }
 
-    /* check exit codes to see if child exitted already, if so, copy code, remove code to avoid waiting for the same child again 
-    (case 3 of wait.c) and return pid */
-    for (i = 0; i < array_getnum(curthread->child_exit_codes); i++) {
-        struct exitted_thread *e = array_getguy(curthread->child_exit_codes, i);
-        if (e->pid == pid) {
-            *kernel_src = e->exitcode;
-            /* remove this exit code */
-            array_remove(curthread->child_exit_codes, i);
-            copy_err = copyout(kernel_src, (userptr_t) status, sizeof (int));
-            if (copy_err) {
-                *err = copy_err;
-                splx(spl);
-                return -1;
-            }
-            splx(spl);
-            return pid;
-        } 
-    }
-    
-    /* if we could not find child exit code and could not find child pid in thread array,
-    then it means we are waiting for a non-existant thread (in wait test, this is case 3
-    where the parent is waiting for the child twice), return an error */
-    if (child == NULL) {
-        *err = EINVAL;
-        splx(spl);
+    /* fails if pid isn't our child, or has been waited for already */
+    spl = splhigh();
+    result = proc_wait(pid, options & WNOHANG, &retpid, &exitcode);
+    splx(spl);
+    if (result) {
+        *err = result;
         return -1;
     }
 
-    thread_sleep(child);
-
-    for (i = 0; i < array_getnum(curthread->child_exit_codes); i++) {
-        struct exitted_thread *e = array_getguy(curthread->child_exit_codes, i);
-        if (e->pid == pid) {
-            *kernel_src = e->exitcode;
-            copy_err = copyout(kernel_src, (userptr_t) status, sizeof (int));
-            /* remove this exit code */
-            array_remove(curthread->child_exit_codes, i);
-            if (copy_err) {
-                *err = copy_err;
-                splx(spl);
-                return -1;
-            }
-            splx(spl);
-            return pid;
-        } 
+    /* with WNOHANG, 0 means no child has exited yet */
+    if (retpid != 0) {
+        result = copyout(&exitcode, (userptr_t) status, sizeof (int));
+        if (result) {
+            *err = result;
+            return -1;
+        }
     }
-    panic("Should not get here in sys__waitpid, debug please!!");
-    return 0;
+    return retpid;
 }
 
 
@@ -321,6 +298,7 @@ int try_copy_args(char ** args, int *err) {
     int result;
     char **copy = kmalloc(sizeof (char *));
     result = copyin((userptr_t) args, copy, sizeof (char *));
+    kfree(copy);
     if (result) {
         *err = result;
         return -1;
@@ -345,6 +323,27 @@ int try_copy_each_arg(char ** args, int *err) {
     return 0;
 }
 
+/* free the kernel copies of the args and their lengths */
+static
+void
+free_execargs(struct array *args_kernel, struct array *arglens)
+{
+    int i;
+
+    if (args_kernel != NULL) {
+        for (i = 0; i < array_getnum(args_kernel); i++) {
+            kfree(array_getguy(args_kernel, i));
+        }
+        array_destroy(args_kernel);
+    }
+    if (arglens != NULL) {
+        for (i = 0; i < array_getnum(arglens); i++) {
+            kfree(array_getguy(arglens, i));
+        }
+        array_destroy(arglens);
+    }
+}
+
 int
 sys_execv(const char *program, char ** args, int *err) {
     // kprintf("IN SYS EXECV");
@@ -379,37 +378,48 @@ sys_execv(const char *program, char ** args, int *err) {
     }
     // kprintf("After comparison");
     /* copy program name into kernel space, make 2 copies in case vfs_open destroys one */
+    struct array *args_kernel = NULL;
+    struct array *arglens = NULL;
+    char **argv = NULL;
     char * program_kernel = kmalloc(strlen(program) + 1);
     char * program_kernel_2 = kmalloc(strlen(program) + 1);
+    if (program_kernel == NULL || program_kernel_2 == NULL) {
+        kfree(program_kernel_2);
+        *err = ENOMEM;
+        goto fail;
+    }
     result = copyin((userptr_t) program, program_kernel, strlen(program) + 1);
     // kprintf("Pointer is 0x%x", (int) program);
     // kprintf("Result is: %d", result);
     if (result) {
+        kfree(program_kernel_2);
         *err = result;
-        return -1;
+        goto fail;
     }
     result = copyin((userptr_t) program, program_kernel_2, strlen(program) + 1);
     if (result) {
+        kfree(program_kernel_2);
         *err = result;
-        return -1;
+        goto fail;
     }
     // kprintf("copied program name: %s", program_kernel);
-    struct array *args_kernel = array_create();
+    args_kernel = array_create();
+    arglens = array_create();
+    if (args_kernel == NULL || arglens == NULL) {
+        kfree(program_kernel_2);
+        *err = ENOMEM;
+        goto fail;
+    }
     result = array_preallocate(args_kernel, 1);
     if (result) {
+        kfree(program_kernel_2);
         *err = ENOMEM;
-        return -1;
+        goto fail;
     }
     /* add the program name as the first argument */
     int prog_len = strlen(program_kernel_2) + 1;
     int padding = next_multiple_of_4(prog_len) - prog_len;
     int prog_total_len = prog_len + padding;
-    int *prog_total_len_ptr = kmalloc(sizeof (int));
-    if (prog_total_len_ptr == NULL) {
-        *err = ENOMEM;
-        return -1;
-    }
-    *prog_total_len_ptr = prog_total_len;
     assert(padding < 4);
     assert(prog_total_len % 4 == 0);
     char *prog_copy = program_kernel_2 + prog_len;
@@ -418,13 +428,17 @@ sys_execv(const char *program, char ** args, int *err) {
     }
     array_add(args_kernel, program_kernel_2);
 
-
-    struct array *arglens = array_create();
     result = array_preallocate(arglens, 1);
     if (result) {
         *err = ENOMEM;
-        return -1;
+        goto fail;
+    }
+    int *prog_total_len_ptr = kmalloc(sizeof (int));
+    if (prog_total_len_ptr == NULL) {
+        *err = ENOMEM;
+        goto fail;
     }
+    *prog_total_len_ptr = prog_total_len;
     array_add(arglens, prog_total_len_ptr);
     i = 0;
     while (args[i] != NULL) {
@@ -435,17 +449,33 @@ sys_execv(const char *program, char ** args, int *err) {
         }
         if (args[i] == NULL || strlen(args[i]) == 0) {
             *err = EFAULT;
-            return -1;
+            goto fail;
         }
         int arg_len = strlen(args[i]) + 1;
         int padding = next_multiple_of_4(arg_len) - arg_len;
         assert(padding < 4);
 
+        /* make room in both arrays first, so the adds can't fail */
+        int array_len = array_getnum(args_kernel);
+        result = array_preallocate(args_kernel, array_len + 1);
+        if (result == 0) {
+            result = array_preallocate(arglens, array_len + 1);
+        }
+        if (result) {
+            *err = ENOMEM;
+            goto fail;
+        }
+
         char *arg = kmalloc(arg_len + padding);
+        if (arg == NULL) {
+            *err = ENOMEM;
+            goto fail;
+        }
         result = copyin((userptr_t) args[i], arg, arg_len);
         if (result) {
+            kfree(arg);
             *err = result;
-            return -1;
+            goto fail;
         }
         char * arg_copy = arg + arg_len;
         // kprintf("Got arg %s\n", arg);
@@ -456,27 +486,20 @@ sys_execv(const char *program, char ** args, int *err) {
         }
         // kprintf("Arg length after padding: %d\n", arg_len + padding);
         // kprintf("Arg after padding: %s", arg);
-        /* append padded string to array */
-        int array_len = array_getnum(args_kernel);
-        result = array_preallocate(args_kernel, array_len + 1);
-        if (result) {
-            *err = ENOMEM;
-            return -1;
-        }
-        array_add(args_kernel, arg);
 
         /* keep in track of how long each argument was */
-        result = array_preallocate(arglens, array_len + 1);
-        if (result) {
-            *err = ENOMEM;
-            return -1;
-        }
-
-        /* push total length of this argument into arglens */
         int arg_total_len = arg_len + padding;
         assert(arg_total_len % 4 == 0);
         int *arg_total_len_ptr = kmalloc(sizeof (int));
+        if (arg_total_len_ptr == NULL) {
+            kfree(arg);
+            *err = ENOMEM;
+            goto fail;
+        }
         *arg_total_len_ptr = arg_total_len;
+
+        /* append padded string and its total length */
+        array_add(args_kernel, arg);
         array_add(arglens, arg_total_len_ptr);
         i++;
     }
@@ -490,29 +513,30 @@ sys_execv(const char *program, char ** args, int *err) {
 
     /* Code from run program */
 
-    /* destroy memory space of curthread */
-    as_destroy(curthread->t_vmspace);
-    curthread->t_vmspace = NULL;
-
     struct vnode *v;
+    struct addrspace *oldas;
 	vaddr_t entrypoint, stackptr;
 
 	/* Open the file. */
 	result = vfs_open(program_kernel, O_RDONLY, &v);
+	kfree(program_kernel);
+	program_kernel = NULL;
 	if (result) {
-        *err = EINVAL;
-		return -1;
+        *err = result;
+		goto fail;
 	}
 
-	/* We should be a new thread. */
-	assert(curthread->t_vmspace == NULL);
-
-	/* Create a new address space. */
+	/*
+	 * Build the new address space beside the old one, which we go
+	 * back to if anything fails, so the caller sees the error.
+	 */
+	oldas = curthread->t_vmspace;
 	curthread->t_vmspace = as_create();
 	if (curthread->t_vmspace==NULL) {
+		curthread->t_vmspace = oldas;
 		vfs_close(v);
         *err = ENOMEM;
-		return -1;
+		goto fail;
 	}
 
 	/* Activate it. */
@@ -521,10 +545,9 @@ sys_execv(const char *program, char ** args, int *err) {
 	/* Load the executable. */
 	result = load_elf(v, &entrypoint);
 	if (result) {
-        *err = EINVAL;
-		/* thread_exit destroys curthread->t_vmspace */
+        *err = result;
 		vfs_close(v);
-		return -1;
+		goto fail_as;
 	}
 
 	/* Done with the file now. */
@@ -532,14 +555,16 @@ sys_execv(const char *program, char ** args, int *err) {
 	/* Define the user stack in the address space */
 	result = as_define_stack(curthread->t_vmspace, &stackptr);
 	if (result) {
-		/* thread_exit destroys curthread->t_vmspace */
         *err = result;
-		return -1;
+		goto fail_as;
 	}
     
     /* get the stack pointer addresses of args and store in argv */
-    char * argv[argc + 1];
-    
+    argv = kmalloc((argc + 1) * sizeof(char *));
+    if (argv == NULL) {
+        *err = ENOMEM;
+        goto fail_as;
+    }
     argv[argc] = NULL;
     vaddr_t stackptr_copy = stackptr;
     for (i = array_getnum(args_kernel) - 1; i >= 0; i--) {
@@ -561,7 +586,8 @@ sys_execv(const char *program, char ** args, int *err) {
         printPaddedArg(arg, arg_len);
         result = copyout(arg, (userptr_t) stackptr, arg_len);
         if (result) {
-            panic("copy out error when copying args");
+            *err = result;
+            goto fail_as;
         }
     }
      
@@ -572,19 +598,31 @@ sys_execv(const char *program, char ** args, int *err) {
         if (address == NULL) {
             result = copyout(&argv[i], (userptr_t) stackptr, 4);
             if (result) {
-                panic("copy out error when copying arg addresses");
+                *err = result;
+                goto fail_as;
             }
             continue;
         }
         result = copyout(&address, (userptr_t) stackptr, 4);
         if (result) {
-            panic("copy out error when copying arg addresses");
+            *err = result;
+            goto fail_as;
         }
     }
 
     // kprintf("final stack pointer: 0x%x\n", stackptr);
     // kprintf("final arg c: %d\n", argc);
     /* copy arguments and addresses to stack */
+
+    /* everything is on the user stack now */
+    kfree(argv);
+    free_execargs(args_kernel, arglens);
+
+    /* nothing can fail any more, so the old address space can go */
+    if (oldas != NULL) {
+        as_destroy(oldas);
+    }
+
 	/* Warp to user mode. argv is the same as stack ptr (from piazza) */
 	md_usermode(argc /*argc*/, (userptr_t) stackptr /*userspace addr of argv*/,
 		    stackptr, entrypoint);
@@ -593,13 +631,15 @@ sys_execv(const char *program, char ** args, int *err) {
 	panic("md_usermode returned\n");
 	return EINVAL;
 
-    // kprintf("Got number of args: %d", array_getnum(args_kernel));
-
-    // /* Open the file. */
-	// result = vfs_open(progname, O_RDONLY, &v);
-	// if (result) {
-	// 	return result;
-	// }
+ fail_as:
+    /* switch back before throwing the new address space away */
+    as_activate(oldas);
+    as_destroy(curthread->t_vmspace);
+    curthread->t_vmspace = oldas;
+    kfree(argv);
+ fail:
+    kfree(program_kernel);
+    free_execargs(args_kernel, arglens);
     return -1;
 }
 
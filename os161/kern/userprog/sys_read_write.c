@@ -1,56 +1,123 @@
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/unistd.h>
+#include <kern/stat.h>
 #include <lib.h>
 #include <machine/pcb.h>
 #include <machine/spl.h>
 #include <machine/trapframe.h>
 #include <kern/callno.h>
 #include <syscall.h>
+#include <curthread.h>
+#include <thread.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <file.h>
+#include <vm.h>
+#include <vmobj.h>
 
-/* Constants for read/write/etc: special file handles */
-#define STDIN_FILENO  0      /* Standard input */
-#define STDOUT_FILENO 1      /* Standard output */
-#define STDERR_FILENO 2      /* Standard error */
-
+/*
+ * Read or write LEN bytes at user address BUF through descriptor FD,
+ * at the open file's seek position, and move the seek position past
+ * what was transferred. Hands back the number of bytes transferred.
+ */
+static
 int
-sys_write(int fd, const void *buf, size_t nbytes, int32_t *retval){
-	if(fd != STDOUT_FILENO && fd != STDERR_FILENO){
+file_rw(int fd, userptr_t buf, size_t len, enum uio_rw rw, int32_t *retval)
+{
+	struct openfile *of;
+	struct stat st;
+	struct uio u;
+	int how, result;
+
+	if (curthread->t_filetable == NULL) {
 		return EBADF;
 	}
-	char *kernel_dest = kmalloc(nbytes);
-	int err = copyin(buf, kernel_dest, nbytes);
-	if(err != 0){
-		return err;
-	}
-	unsigned int i = 0;
-	unsigned int r = 0;
-	for(i = 0; i < nbytes; i++){
-		putch(kernel_dest[i]);
-		r++;
+	result = file_get(curthread->t_filetable, fd, &of);
+	if (result) {
+		return result;
 	}
-	*retval = r;
-	kfree(kernel_dest);
-	return 0;
-}
 
-int
-sys_read(int fd, void *buf, size_t buflen){
-	if(fd != STDIN_FILENO){
+	how = of->of_flags & O_ACCMODE;
+	if ((rw == UIO_READ && how == O_WRONLY) ||
+	    (rw == UIO_WRITE && how == O_RDONLY)) {
 		return EBADF;
 	}
-	if(buflen != 1){
-		// kprintf("RETURNING WITH BUFLEN NOT 1");
-		return EUNIMP;
+
+	lock_acquire(of->of_lock);
+
+	if (rw == UIO_WRITE && (of->of_flags & O_APPEND)) {
+		result = VOP_STAT(of->of_vnode, &st);
+		if (result) {
+			lock_release(of->of_lock);
+			return result;
+		}
+		of->of_offset = st.st_size;
+	}
+
+	u.uio_iovec.iov_ubase = buf;
+	u.uio_iovec.iov_len = len;
+	u.uio_offset = of->of_offset;
+	u.uio_resid = len;
+	u.uio_segflg = UIO_USERSPACE;
+	u.uio_rw = rw;
+	u.uio_space = curthread->t_vmspace;
+
+	if (rw == UIO_READ) {
+		result = VOP_READ(of->of_vnode, &u);
 	}
-	char *kernel_src = kmalloc(buflen);
-	// unsigned i;
-	// kprintf("KERNEL SRC: %c", *kernel_src);
-
- 	kernel_src[0] = getch();
-	// kprintf("KERNEL SRC: %c", kernel_src[0]);
-	int err = copyout(kernel_src, buf, buflen);
-    kfree(kernel_src);
-	return err;
+	else {
+#if OPT_DUMBVM
+		result = VOP_WRITE(of->of_vnode, &u);
+#else
+		/* Mapped pages of the file have to see the new data. */
+		result = vmobj_write(of->of_vnode, &u);
+#endif
+	}
+	if (result == 0) {
+		of->of_offset = u.uio_offset;
+		*retval = len - u.uio_resid;
+	}
+
+	lock_release(of->of_lock);
+	return result;
 }
 
+/*
+WRITE
+****Description****
+write writes up to NBYTES bytes from BUF to the file named by FD, at
+the file's seek position, and advances the seek position by the number
+of bytes written. If the file was opened with O_APPEND, the seek
+position is first moved to the end of the file.
 
+****Errors****
+EBADF	FD is not a valid descriptor, or was not opened for writing.
+EFAULT	Part or all of BUF is invalid.
+ENOSPC	There is no free space remaining on the filesystem.
+EIO	A hardware I/O error occurred writing the data.
+*/
+int
+sys_write(int fd, const void *buf, size_t nbytes, int32_t *retval)
+{
+	return file_rw(fd, (userptr_t)buf, nbytes, UIO_WRITE, retval);
+}
+
+/*
+READ
+****Description****
+read reads up to BUFLEN bytes into BUF from the file named by FD, at
+the file's seek position, and advances the seek position by the number
+of bytes read. Returns 0 at end of file.
+
+****Errors****
+EBADF	FD is not a valid descriptor, or was not opened for reading.
+EFAULT	Part or all of BUF is invalid.
+EIO	A hardware I/O error occurred reading the data.
+*/
+int
+sys_read(int fd, void *buf, size_t buflen, int32_t *retval)
+{
+	return file_rw(fd, (userptr_t)buf, buflen, UIO_READ, retval);
+}
@@ -1,316 +1,688 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <elf.h>
 #include <thread.h>
 #include <curthread.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <swap.h>
+#include <vmobj.h>
+#include <vnode.h>
+#include <kern/mman.h>
 #include <machine/spl.h>
 #include <machine/tlb.h>
 
 /*
- * Dumb MIPS-only "VM system" that is intended to only be just barely
- * enough to struggle off the ground. You should replace all of this
- * code while doing the VM assignment. In fact, starting in that
- * assignment, this file is not included in your kernel!
+ * Address spaces for the demand-paged VM system.
+ *
+ * Nothing is allocated up front: as_define_region and as_define_stack
+ * only record which addresses are legal, and vm_fault gives each page
+ * a zero-filled frame the first time it is touched. Pages may later
+ * be paged out to swap (see swap.c) and brought back by vm_fault.
  */
 
-/* under dumbvm, always have 48k of user stack */
-#define DUMBVM_STACKPAGES    12
-
-void
-vm_bootstrap(void)
+struct addrspace *
+as_create(void)
 {
-	/* Do nothing. */
+	struct addrspace *as = kmalloc(sizeof(struct addrspace));
+	if (as==NULL) {
+		return NULL;
+	}
+
+	as->as_pt = pt_create();
+	if (as->as_pt==NULL) {
+		kfree(as);
+		return NULL;
+	}
+
+	as->as_regions = NULL;
+	as->as_nregions = 0;
+	as->as_maxregions = 0;
+	as->as_stack.rg_vbase = 0;
+	as->as_stack.rg_npages = 0;
+	as->as_stack.rg_perm = 0;
+	as->as_stack.rg_obj = NULL;
+	as->as_stack.rg_objoff = 0;
+	as->as_stack.rg_filesz = 0;
+	as->as_stack.rg_mapflags = 0;
+	as->as_stacklimit = VM_STACKLIMIT;
+	as->as_heap.rg_vbase = 0;
+	as->as_heap.rg_npages = 0;
+	as->as_heap.rg_perm = PF_R | PF_W;
+	as->as_heap.rg_obj = NULL;
+	as->as_heap.rg_objoff = 0;
+	as->as_heap.rg_filesz = 0;
+	as->as_heap.rg_mapflags = 0;
+	as->as_heapend = 0;
+	as->as_loading = 0;
+	as->as_tlbmisses = 0;
+	as->as_ntlb = 0;
+
+	return as;
 }
 
 static
-paddr_t
-getppages(unsigned long npages)
+int
+as_freepage(vaddr_t vaddr, pte_t *pte, void *data)
 {
 	int spl;
-	paddr_t addr;
+
+	(void)vaddr;
+	(void)data;
 
 	spl = splhigh();
 
-	addr = ram_stealmem(npages);
-	
+	/* Let the page-out daemon finish with it first. */
+	while (*pte & PTE_BUSY) {
+		thread_sleep(pte);
+	}
+
+	if (*pte & PTE_VALID) {
+		coremap_free(PTE_PADDR(*pte));
+	}
+	else if (*pte & PTE_SWAPPED) {
+		swap_free(PTE_SLOT(*pte));
+	}
+	*pte = 0;
+
 	splx(spl);
-	return addr;
+	return 0;
 }
 
-/* Allocate/free some kernel-space virtual pages */
-vaddr_t 
-alloc_kpages(int npages)
+void
+as_destroy(struct addrspace *as)
 {
-	paddr_t pa;
-	pa = getppages(npages);
-	if (pa==0) {
-		return 0;
+	int i;
+
+	DEBUG(DB_VM, "vm: %u TLB misses\n", as->as_tlbmisses);
+
+	/* Stop the vmobjs reaching into this address space first. */
+	for (i=0; i<as->as_nregions; i++) {
+		if (as->as_regions[i].rg_obj != NULL) {
+			vmobj_unmap(as->as_regions[i].rg_obj, as,
+				    &as->as_regions[i]);
+		}
 	}
-	return PADDR_TO_KVADDR(pa);
+
+	vm_tlbforget(as);
+	pt_foreach(as->as_pt, as_freepage, NULL);
+	pt_destroy(as->as_pt);
+
+	for (i=0; i<as->as_nregions; i++) {
+		if (as->as_regions[i].rg_obj != NULL) {
+			vmobj_release(as->as_regions[i].rg_obj);
+		}
+	}
+	if (as->as_regions != NULL) {
+		kfree(as->as_regions);
+	}
+	kfree(as);
 }
 
-void 
-free_kpages(vaddr_t addr)
+void
+as_activate(struct addrspace *as)
 {
-	/* nothing */
-
-	(void)addr;
+	vm_tlbactivate(as);
 }
 
+/*
+ * Binary search for the first region that ends above VADDR. Returns
+ * as_nregions if there isn't one.
+ */
+static
 int
-vm_fault(int faulttype, vaddr_t faultaddress)
+as_findindex(struct addrspace *as, vaddr_t vaddr)
 {
-	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
-	paddr_t paddr;
-	int i;
-	u_int32_t ehi, elo;
-	struct addrspace *as;
-	int spl;
-
-	spl = splhigh();
-
-	faultaddress &= PAGE_FRAME;
+	struct region *rg;
+	int lo, hi, mid;
+
+	lo = 0;
+	hi = as->as_nregions;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		rg = &as->as_regions[mid];
+		if (rg->rg_vbase + rg->rg_npages * PAGE_SIZE <= vaddr) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
 
-	DEBUG(DB_VM, "dumbvm: fault: 0x%x\n", faultaddress);
+struct region *
+as_getregion(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *rg;
+	int ix;
 
-	switch (faulttype) {
-	    case VM_FAULT_READONLY:
-		/* We always create pages read-write, so we can't get this */
-		panic("dumbvm: got VM_FAULT_READONLY\n");
-	    case VM_FAULT_READ:
-	    case VM_FAULT_WRITE:
-		break;
-	    default:
-		splx(spl);
-		return EINVAL;
+	ix = as_findindex(as, vaddr);
+	if (ix < as->as_nregions && as->as_regions[ix].rg_vbase <= vaddr) {
+		return &as->as_regions[ix];
 	}
 
-	as = curthread->t_vmspace;
-	if (as == NULL) {
-		/*
-		 * No address space set up. This is probably a kernel
-		 * fault early in boot. Return EFAULT so as to panic
-		 * instead of getting into an infinite faulting loop.
-		 */
-		return EFAULT;
+	rg = &as->as_heap;
+	if (vaddr >= rg->rg_vbase &&
+	    vaddr < rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+		return rg;
 	}
 
-	/* Assert that the address space has been set up properly. */
-	assert(as->as_vbase1 != 0);
-	assert(as->as_pbase1 != 0);
-	assert(as->as_npages1 != 0);
-	assert(as->as_vbase2 != 0);
-	assert(as->as_pbase2 != 0);
-	assert(as->as_npages2 != 0);
-	assert(as->as_stackpbase != 0);
-	assert((as->as_vbase1 & PAGE_FRAME) == as->as_vbase1);
-	assert((as->as_pbase1 & PAGE_FRAME) == as->as_pbase1);
-	assert((as->as_vbase2 & PAGE_FRAME) == as->as_vbase2);
-	assert((as->as_pbase2 & PAGE_FRAME) == as->as_pbase2);
-	assert((as->as_stackpbase & PAGE_FRAME) == as->as_stackpbase);
-
-	vbase1 = as->as_vbase1;
-	vtop1 = vbase1 + as->as_npages1 * PAGE_SIZE;
-	vbase2 = as->as_vbase2;
-	vtop2 = vbase2 + as->as_npages2 * PAGE_SIZE;
-	stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
-	stacktop = USERSTACK;
-
-	if (faultaddress >= vbase1 && faultaddress < vtop1) {
-		paddr = (faultaddress - vbase1) + as->as_pbase1;
-	}
-	else if (faultaddress >= vbase2 && faultaddress < vtop2) {
-		paddr = (faultaddress - vbase2) + as->as_pbase2;
-	}
-	else if (faultaddress >= stackbase && faultaddress < stacktop) {
-		paddr = (faultaddress - stackbase) + as->as_stackpbase;
+	rg = &as->as_stack;
+	if (vaddr >= rg->rg_vbase &&
+	    vaddr < rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+		return rg;
 	}
-	else {
-		splx(spl);
+
+	return NULL;
+}
+
+/*
+ * Add an anonymous region; common code for as_define_region and
+ * as_define_file.
+ */
+static
+int
+as_addregion(struct addrspace *as, vaddr_t vaddr, size_t sz,
+	     int readable, int writeable, int executable,
+	     struct region **ret)
+{
+	struct region *rg, *newregions;
+	vaddr_t end, rgend;
+	int ix, n, perm;
+
+	/* Align the region. First, the base... */
+	sz += vaddr & ~(vaddr_t)PAGE_FRAME;
+	vaddr &= PAGE_FRAME;
+
+	/* ...and now the length. */
+	sz = (sz + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	end = vaddr + sz;
+	if (end > USERSTACK - as->as_stacklimit || end < vaddr) {
 		return EFAULT;
 	}
 
-	/* make sure it's page-aligned */
-	assert((paddr & PAGE_FRAME)==paddr);
+	perm = (readable ? PF_R : 0) | (writeable ? PF_W : 0) |
+		(executable ? PF_X : 0);
 
-	for (i=0; i<NUM_TLB; i++) {
-		TLB_Read(&ehi, &elo, i);
-		if (elo & TLBLO_VALID) {
-			continue;
+	/* Make sure there's room for one more. */
+	if (as->as_nregions == as->as_maxregions) {
+		n = as->as_maxregions ? 2 * as->as_maxregions : 4;
+		newregions = kmalloc(n * sizeof(struct region));
+		if (newregions == NULL) {
+			return ENOMEM;
 		}
-		ehi = faultaddress;
-		elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-		DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
-		TLB_Write(ehi, elo, i);
-		splx(spl);
-		return 0;
+		if (as->as_regions != NULL) {
+			memcpy(newregions, as->as_regions,
+			       as->as_nregions * sizeof(struct region));
+			kfree(as->as_regions);
+		}
+		as->as_regions = newregions;
+		as->as_maxregions = n;
 	}
 
-	kprintf("dumbvm: Ran out of TLB entries - cannot handle page fault\n");
-	splx(spl);
-	return EFAULT;
+	/*
+	 * Segments whose ends share a page can't have separate
+	 * permissions or backing, so any region this one overlaps is
+	 * absorbed into it. That only happens while the executable's
+	 * segments are being defined, before anything has been loaded.
+	 */
+	ix = as_findindex(as, vaddr);
+	while (ix < as->as_nregions && as->as_regions[ix].rg_vbase < end) {
+		rg = &as->as_regions[ix];
+		rgend = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+		if (rg->rg_vbase < vaddr) {
+			vaddr = rg->rg_vbase;
+		}
+		if (rgend > end) {
+			end = rgend;
+		}
+		perm |= rg->rg_perm;
+		if (rg->rg_obj != NULL) {
+			vmobj_unmap(rg->rg_obj, as, rg);
+			vmobj_release(rg->rg_obj);
+		}
+		as->as_nregions--;
+		memmove(rg, rg + 1, (as->as_nregions - ix) * sizeof(*rg));
+	}
+
+	/* Insert at IX, keeping the array sorted. */
+	rg = &as->as_regions[ix];
+	memmove(rg + 1, rg, (as->as_nregions - ix) * sizeof(*rg));
+	as->as_nregions++;
+
+	rg->rg_vbase = vaddr;
+	rg->rg_npages = (end - vaddr) / PAGE_SIZE;
+	rg->rg_perm = perm;
+	rg->rg_obj = NULL;
+	rg->rg_objoff = 0;
+	rg->rg_filesz = 0;
+	rg->rg_mapflags = 0;
+
+	*ret = rg;
+	return 0;
 }
 
-struct addrspace *
-as_create(void)
+/*
+ * Take RG out of the region array. Its pages must be gone already.
+ */
+static
+void
+as_removeregion(struct addrspace *as, struct region *rg)
 {
-	struct addrspace *as = kmalloc(sizeof(struct addrspace));
-	if (as==NULL) {
+	int ix;
+
+	ix = rg - as->as_regions;
+	as->as_nregions--;
+	memmove(rg, rg + 1, (as->as_nregions - ix) * sizeof(*rg));
+}
+
+struct region *
+as_growstack(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *rg = &as->as_stack;
+
+	vaddr &= PAGE_FRAME;
+
+	if (rg->rg_npages == 0 || vaddr >= rg->rg_vbase ||
+	    vaddr < USERSTACK - as->as_stacklimit) {
 		return NULL;
 	}
 
-	as->as_vbase1 = 0;
-	as->as_pbase1 = 0;
-	as->as_npages1 = 0;
-	as->as_vbase2 = 0;
-	as->as_pbase2 = 0;
-	as->as_npages2 = 0;
-	as->as_stackpbase = 0;
+	DEBUG(DB_VM, "vm: stack grows from 0x%x to 0x%x\n",
+	      rg->rg_vbase, vaddr);
 
-	return as;
+	rg->rg_npages += (rg->rg_vbase - vaddr) / PAGE_SIZE;
+	rg->rg_vbase = vaddr;
+	return rg;
 }
 
+/*
+ * Unmap and free the pages from START up to END.
+ */
+static
 void
-as_destroy(struct addrspace *as)
+as_freerange(struct addrspace *as, vaddr_t start, vaddr_t end)
 {
-	kfree(as);
+	vaddr_t va;
+	pte_t *pte;
+
+	for (va = start; va < end; va += PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, va, 0);
+		if (pte != NULL && *pte != 0) {
+			vm_tlbinvalidate(as, va);
+			as_freepage(va, pte, NULL);
+		}
+	}
 }
 
-void
-as_activate(struct addrspace *as)
+int
+as_sbrk(struct addrspace *as, intptr_t change, vaddr_t *oldbreak)
 {
-	int i, spl;
+	struct region *rg = &as->as_heap;
+	vaddr_t newbreak, oldend, newend, limit;
+	int ix;
 
-	(void)as;
-
-	spl = splhigh();
+	if (change < 0 && (vaddr_t)-change > as->as_heapend - rg->rg_vbase) {
+		return EINVAL;
+	}
 
-	for (i=0; i<NUM_TLB; i++) {
-		TLB_Write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	/* The heap can grow up to the next region, or the stack. */
+	ix = as_findindex(as, rg->rg_vbase);
+	if (ix < as->as_nregions) {
+		limit = as->as_regions[ix].rg_vbase;
+	}
+	else {
+		limit = USERSTACK - as->as_stacklimit;
+	}
+	if (change > 0 && (vaddr_t)change > limit - as->as_heapend) {
+		return ENOMEM;
 	}
 
-	splx(spl);
+	newbreak = as->as_heapend + change;
+	oldend = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+	newend = (newbreak + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	/* Throw away whatever was in the pages we're giving back. */
+	as_freerange(as, newend, oldend);
+
+	*oldbreak = as->as_heapend;
+	as->as_heapend = newbreak;
+	rg->rg_npages = (newend - rg->rg_vbase) / PAGE_SIZE;
+	return 0;
 }
 
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 		 int readable, int writeable, int executable)
 {
-	size_t npages; 
+	struct region *rg;
 
-	/* Align the region. First, the base... */
-	sz += vaddr & ~(vaddr_t)PAGE_FRAME;
-	vaddr &= PAGE_FRAME;
+	return as_addregion(as, vaddr, sz, readable, writeable, executable,
+			    &rg);
+}
 
-	/* ...and now the length. */
-	sz = (sz + PAGE_SIZE - 1) & PAGE_FRAME;
+int
+as_define_file(struct addrspace *as, vaddr_t vaddr, size_t sz,
+	       struct vnode *v, off_t offset, size_t filesz,
+	       int readable, int writeable, int executable)
+{
+	struct region *rg;
+	struct vmobj *obj;
+	int result;
 
-	npages = sz / PAGE_SIZE;
+	/* File pages have to line up with our pages to be shared. */
+	if ((vaddr & ~(vaddr_t)PAGE_FRAME) != (vaddr_t)(offset % PAGE_SIZE)) {
+		return EINVAL;
+	}
 
-	/* We don't use these - all pages are read-write */
-	(void)readable;
-	(void)writeable;
-	(void)executable;
+	/* Nor can they share a page with another region. */
+	if (as_getregion(as, vaddr) != NULL ||
+	    as_getregion(as, vaddr + sz - 1) != NULL ||
+	    as_findindex(as, vaddr) != as_findindex(as, vaddr + sz - 1)) {
+		return EINVAL;
+	}
 
-	if (as->as_vbase1 == 0) {
-		as->as_vbase1 = vaddr;
-		as->as_npages1 = npages;
-		return 0;
+	result = vmobj_get(v, &obj);
+	if (result) {
+		return result;
 	}
 
-	if (as->as_vbase2 == 0) {
-		as->as_vbase2 = vaddr;
-		as->as_npages2 = npages;
-		return 0;
+	result = as_addregion(as, vaddr, sz, readable, writeable, executable,
+			      &rg);
+	if (result) {
+		vmobj_release(obj);
+		return result;
 	}
 
+	rg->rg_obj = obj;
+	rg->rg_objoff = offset - (vaddr & ~(vaddr_t)PAGE_FRAME);
+
 	/*
-	 * Support for more than two regions is not available.
+	 * If nothing comes after the file data, whatever follows it in
+	 * the file's last page may as well stay, so that page can be
+	 * shared too.
 	 */
-	kprintf("dumbvm: Warning: too many regions\n");
-	return EUNIMP;
+	if (filesz < sz) {
+		rg->rg_filesz = (vaddr & ~(vaddr_t)PAGE_FRAME) + filesz;
+	}
+	else {
+		rg->rg_filesz = rg->rg_npages * PAGE_SIZE;
+	}
+
+	result = vmobj_map(obj, as, rg);
+	if (result) {
+		as_removeregion(as, rg);
+		vmobj_release(obj);
+		return result;
+	}
+	return 0;
 }
 
+/*
+ * Find room for SZ bytes (page-aligned) between the heap and the
+ * stack. Mappings are placed as high as possible, to leave the heap
+ * room to grow.
+ */
+static
 int
-as_prepare_load(struct addrspace *as)
+as_findgap(struct addrspace *as, size_t sz, vaddr_t *ret)
 {
-	assert(as->as_pbase1 == 0);
-	assert(as->as_pbase2 == 0);
-	assert(as->as_stackpbase == 0);
+	struct region *rg;
+	vaddr_t top, bottom, end;
+	int ix;
+
+	top = USERSTACK - as->as_stacklimit;
+	bottom = as->as_heap.rg_vbase + as->as_heap.rg_npages * PAGE_SIZE;
+
+	for (ix = as->as_nregions - 1; ix >= 0; ix--) {
+		rg = &as->as_regions[ix];
+		end = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+		if (end <= bottom) {
+			break;
+		}
+		if (top >= end && top - end >= sz) {
+			*ret = top - sz;
+			return 0;
+		}
+		top = rg->rg_vbase;
+	}
 
-	as->as_pbase1 = getppages(as->as_npages1);
-	if (as->as_pbase1 == 0) {
+	if (top < bottom || top - bottom < sz) {
 		return ENOMEM;
 	}
+	*ret = top - sz;
+	return 0;
+}
 
-	as->as_pbase2 = getppages(as->as_npages2);
-	if (as->as_pbase2 == 0) {
+int
+as_mmap(struct addrspace *as, size_t sz, struct vnode *v, off_t offset,
+	int prot, int flags, vaddr_t *ret)
+{
+	vaddr_t vaddr;
+	int result;
+
+	if (sz == 0 || offset < 0 || offset % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+	if (flags != MAP_SHARED && flags != MAP_PRIVATE) {
+		return EINVAL;
+	}
+	/* The TLB can't make a page writeable but not readable. */
+	if ((prot & PROT_WRITE) && !(prot & PROT_READ)) {
+		return EINVAL;
+	}
+	/* Check before rounding up, which could wrap to 0. */
+	if (sz > USERTOP) {
 		return ENOMEM;
 	}
 
-	as->as_stackpbase = getppages(DUMBVM_STACKPAGES);
-	if (as->as_stackpbase == 0) {
-		return ENOMEM;
+	result = VOP_MMAP(v);
+	if (result) {
+		return result;
+	}
+
+	sz = (sz + PAGE_SIZE - 1) & PAGE_FRAME;
+	result = as_findgap(as, sz, &vaddr);
+	if (result) {
+		return result;
+	}
+
+	result = as_define_file(as, vaddr, sz, v, offset, sz,
+				prot & PROT_READ, prot & PROT_WRITE,
+				prot & PROT_EXEC);
+	if (result) {
+		return result;
 	}
+	as_getregion(as, vaddr)->rg_mapflags = flags;
 
+	DEBUG(DB_VM, "vm: mapped %u bytes at 0x%x\n", sz, vaddr);
+
+	*ret = vaddr;
+	return 0;
+}
+
+int
+as_munmap(struct addrspace *as, vaddr_t vaddr, size_t sz)
+{
+	struct region *rg;
+	struct vmobj *obj;
+
+	sz = (sz + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	rg = as_getregion(as, vaddr);
+	if (rg == NULL || rg->rg_mapflags == 0 || rg->rg_vbase != vaddr ||
+	    rg->rg_npages * PAGE_SIZE != sz) {
+		return EINVAL;
+	}
+
+	obj = rg->rg_obj;
+	vmobj_unmap(obj, as, rg);
+	as_freerange(as, vaddr, vaddr + sz);
+
+	if (rg->rg_mapflags == MAP_SHARED) {
+		/* A failed write is retried when the object goes away. */
+		vmobj_sync(obj);
+	}
+
+	as_removeregion(as, rg);
+	vmobj_release(obj);
+	return 0;
+}
+
+/*
+ * Pages are allocated on first touch, so there's nothing to set up
+ * for loading; but the loader must be allowed to write to regions the
+ * program itself can't.
+ */
+int
+as_prepare_load(struct addrspace *as)
+{
+	as->as_loading = 1;
 	return 0;
 }
 
 int
 as_complete_load(struct addrspace *as)
 {
-	(void)as;
+	struct region *rg;
+
+	as->as_loading = 0;
+
+	/* The heap starts out empty, just past the last segment. */
+	if (as->as_nregions > 0) {
+		rg = &as->as_regions[as->as_nregions - 1];
+		as->as_heap.rg_vbase = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+		as->as_heap.rg_npages = 0;
+		as->as_heapend = as->as_heap.rg_vbase;
+	}
+
+	/* Get rid of writeable mappings of read-only pages. */
+	vm_tlbflush(as);
 	return 0;
 }
 
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
-	assert(as->as_stackpbase != 0);
+	/* Start with one page; as_growstack adds more as needed. */
+	as->as_stack.rg_vbase = USERSTACK - PAGE_SIZE;
+	as->as_stack.rg_npages = 1;
+	as->as_stack.rg_perm = PF_R | PF_W;
 
 	*stackptr = USERSTACK;
 	return 0;
 }
 
+/*
+ * pt_foreach callback for as_copy: share one resident page with the
+ * new address space. vm_fault maps shared frames read-only, and the
+ * first write to one gets a private copy. Pages that are out in swap
+ * are read back into a frame of the new address space's own.
+ */
+static
+int
+as_copypage(vaddr_t vaddr, pte_t *oldpte, void *data)
+{
+	struct addrspace *new = data;
+	pte_t *newpte;
+	paddr_t pa;
+	int spl, result;
+
+	newpte = pt_lookup(new->as_pt, vaddr, 1);
+	if (newpte == NULL) {
+		return ENOMEM;
+	}
+
+	spl = splhigh();
+
+	while (*oldpte & PTE_BUSY) {
+		thread_sleep(oldpte);
+	}
+
+	if (*oldpte & PTE_VALID) {
+		coremap_incref(PTE_PADDR(*oldpte));
+		*newpte = *oldpte;
+		splx(spl);
+		return 0;
+	}
+	splx(spl);
+
+	assert(*oldpte & PTE_SWAPPED);
+
+	pa = coremap_alloc(1);
+	if (pa == 0) {
+		return ENOMEM;
+	}
+
+	result = swap_read(PTE_SLOT(*oldpte), pa);
+	if (result) {
+		coremap_free(pa);
+		return result;
+	}
+
+	*newpte = pa | PTE_VALID;
+	coremap_setowner(pa, new, vaddr);
+	return 0;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
-	// kprintf("IN AS COPY");
 	struct addrspace *new;
+	struct region *rg;
+	int i, result;
 
 	new = as_create();
 	if (new==NULL) {
 		return ENOMEM;
 	}
 
-	new->as_vbase1 = old->as_vbase1;
-	new->as_npages1 = old->as_npages1;
-	new->as_vbase2 = old->as_vbase2;
-	new->as_npages2 = old->as_npages2;
-
-	if (as_prepare_load(new)) {
-		as_destroy(new);
-		return ENOMEM;
+	if (old->as_nregions > 0) {
+		new->as_regions = kmalloc(old->as_nregions *
+					  sizeof(struct region));
+		if (new->as_regions == NULL) {
+			as_destroy(new);
+			return ENOMEM;
+		}
+		new->as_maxregions = old->as_nregions;
+	}
+	for (i=0; i<old->as_nregions; i++) {
+		rg = &new->as_regions[i];
+		*rg = old->as_regions[i];
+		new->as_nregions = i + 1;
+		if (rg->rg_obj != NULL) {
+			vmobj_incref(rg->rg_obj);
+			/* Before the PTEs are copied, so they can be found. */
+			result = vmobj_map(rg->rg_obj, new, rg);
+			if (result) {
+				as_destroy(new);
+				return result;
+			}
+		}
 	}
+	new->as_stack = old->as_stack;
+	new->as_stacklimit = old->as_stacklimit;
+	new->as_heap = old->as_heap;
+	new->as_heapend = old->as_heapend;
 
-	assert(new->as_pbase1 != 0);
-	assert(new->as_pbase2 != 0);
-	assert(new->as_stackpbase != 0);
+	result = pt_foreach(old->as_pt, as_copypage, new);
 
-	memmove((void *)PADDR_TO_KVADDR(new->as_pbase1),
-		(const void *)PADDR_TO_KVADDR(old->as_pbase1),
-		old->as_npages1*PAGE_SIZE);
+	/*
+	 * The old address space may still have writeable TLB entries
+	 * for pages that are now shared. Get rid of them.
+	 */
+	vm_tlbflush(old);
 
-	memmove((void *)PADDR_TO_KVADDR(new->as_pbase2),
-		(const void *)PADDR_TO_KVADDR(old->as_pbase2),
-		old->as_npages2*PAGE_SIZE);
+	if (result) {
+		as_destroy(new);
+		return result;
+	}
 
-	memmove((void *)PADDR_TO_KVADDR(new->as_stackpbase),
-		(const void *)PADDR_TO_KVADDR(old->as_stackpbase),
-		DUMBVM_STACKPAGES*PAGE_SIZE);
-	
 	*ret = new;
 	return 0;
 }
@@ -0,0 +1,846 @@
+/*
+ * Coremap: physical page allocator. See coremap.h.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <vm.h>
+#include <thread.h>
+#include <coremap.h>
+#include <slab.h>
+#include <swap.h>
+#include <machine/spl.h>
+
+/* Page states. */
+#define CME_FREE     0	/* on the free list */
+#define CME_FIXED    1	/* holds the coremap itself; never freed */
+#define CME_USED     2	/* allocated */
+#define CME_ZEROING  3	/* off the free list while being zeroed */
+
+/* End-of-list marker for the free list links. */
+#define CM_NONE      (-1)
+
+struct coremap_entry {
+	int cme_next;		/* free list links (coremap indexes) */
+	int cme_prev;
+	u_int32_t cme_npages;	/* block length; set on the first page only */
+	u_int16_t cme_refcount;	/* references; set on the first page only */
+	u_int8_t cme_state;
+	u_int8_t cme_busy;	/* being paged out */
+	u_int8_t cme_zeroed;	/* free, and known to be all zeros */
+	struct addrspace *cme_as; /* owner of an evictable user page */
+	vaddr_t cme_vaddr;	/* ...and where it is mapped there */
+
+	/* Page replacement state; user pages only. */
+	u_int8_t cme_referenced; /* touched since the policy last looked */
+	u_int8_t cme_dirty;	/* differs from the copy in cme_slot */
+	u_int8_t cme_age;	/* aging policy's reference history */
+	u_int32_t cme_seq;	/* allocation order, for FIFO */
+	u_int32_t cme_slot;	/* swap slot holding a copy, or SWAP_NOSLOT */
+};
+
+static struct coremap_entry *coremap;
+static paddr_t coremap_base;	/* physical address of coremap[0]'s page */
+static unsigned coremap_npages;	/* number of entries */
+
+/*
+ * Free list. Pages that still hold old data are kept at the head, and
+ * pre-zeroed pages at the tail, so each kind of allocation can take
+ * the kind of page it wants.
+ */
+static int freelist_head = CM_NONE;
+static int freelist_tail = CM_NONE;
+static unsigned nfree;
+static unsigned nzeroed;	/* free pages with cme_zeroed set */
+
+/*
+ * The page-zeroing thread tops up the pool to ZEROPOOL_TARGET pages,
+ * zeroing at most ZEROPOOL_BATCH each time the CPU goes idle.
+ */
+#define ZEROPOOL_TARGET  32
+#define ZEROPOOL_BATCH   4
+
+/* Nonzero while the zeroing thread is waiting for idle time. */
+static int zero_waiting;
+
+/* Zero-fill allocations served from the pool, and not. */
+static u_int32_t zero_hits, zero_misses;
+
+/* Allocation counter for cme_seq. */
+static u_int32_t coremap_seq;
+
+/* Nonzero once coremap_bootstrap has run. */
+static int coremap_ready;
+
+#define CM_INDEX(pa)  (((pa) - coremap_base) / PAGE_SIZE)
+#define CM_PADDR(ix)  (coremap_base + (paddr_t)(ix) * PAGE_SIZE)
+
+////////////////////////////////////////
+
+static
+void
+freelist_push(int ix)
+{
+	coremap[ix].cme_zeroed = 0;
+	coremap[ix].cme_prev = CM_NONE;
+	coremap[ix].cme_next = freelist_head;
+	if (freelist_head != CM_NONE) {
+		coremap[freelist_head].cme_prev = ix;
+	}
+	else {
+		freelist_tail = ix;
+	}
+	freelist_head = ix;
+	nfree++;
+}
+
+/*
+ * Put a page that has just been zeroed at the tail of the free list.
+ */
+static
+void
+freelist_append(int ix)
+{
+	coremap[ix].cme_zeroed = 1;
+	coremap[ix].cme_next = CM_NONE;
+	coremap[ix].cme_prev = freelist_tail;
+	if (freelist_tail != CM_NONE) {
+		coremap[freelist_tail].cme_next = ix;
+	}
+	else {
+		freelist_head = ix;
+	}
+	freelist_tail = ix;
+	nfree++;
+	nzeroed++;
+}
+
+static
+void
+freelist_unlink(int ix)
+{
+	struct coremap_entry *e = &coremap[ix];
+
+	if (e->cme_prev != CM_NONE) {
+		coremap[e->cme_prev].cme_next = e->cme_next;
+	}
+	else {
+		assert(freelist_head == ix);
+		freelist_head = e->cme_next;
+	}
+	if (e->cme_next != CM_NONE) {
+		coremap[e->cme_next].cme_prev = e->cme_prev;
+	}
+	else {
+		assert(freelist_tail == ix);
+		freelist_tail = e->cme_prev;
+	}
+	e->cme_next = e->cme_prev = CM_NONE;
+	assert(nfree > 0);
+	nfree--;
+	if (e->cme_zeroed) {
+		assert(nzeroed > 0);
+		nzeroed--;
+		e->cme_zeroed = 0;
+	}
+}
+
+////////////////////////////////////////
+
+/*
+ * Take over all remaining physical memory. The coremap itself is
+ * placed at the bottom of that memory, and the pages it occupies are
+ * marked fixed.
+ */
+void
+coremap_bootstrap(void)
+{
+	paddr_t lo, hi;
+	unsigned i, cmpages;
+
+	assert(coremap_ready == 0);
+
+	ram_getsize(&lo, &hi);
+	assert((lo & PAGE_FRAME) == lo);
+	assert((hi & PAGE_FRAME) == hi);
+
+	coremap_base = lo;
+	coremap_npages = (hi - lo) / PAGE_SIZE;
+	cmpages = DIVROUNDUP(coremap_npages * sizeof(struct coremap_entry),
+			     PAGE_SIZE);
+	if (cmpages >= coremap_npages) {
+		panic("coremap: not enough memory for the coremap\n");
+	}
+
+	coremap = (struct coremap_entry *) PADDR_TO_KVADDR(lo);
+
+	/*
+	 * Push in descending order so the free list hands out low
+	 * addresses first.
+	 */
+	for (i=coremap_npages; i-- > 0; ) {
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_refcount = 0;
+		coremap[i].cme_busy = 0;
+		coremap[i].cme_zeroed = 0;
+		coremap[i].cme_as = NULL;
+		coremap[i].cme_vaddr = 0;
+		coremap[i].cme_slot = SWAP_NOSLOT;
+		if (i < cmpages) {
+			coremap[i].cme_state = CME_FIXED;
+			coremap[i].cme_next = coremap[i].cme_prev = CM_NONE;
+		}
+		else {
+			coremap[i].cme_state = CME_FREE;
+			freelist_push(i);
+		}
+	}
+
+	coremap_ready = 1;
+
+	kprintf("coremap: %u pages, %u free\n", coremap_npages, nfree);
+}
+
+/*
+ * Find NPAGES contiguous free pages. Returns the index of the first,
+ * or CM_NONE.
+ */
+static
+int
+coremap_findrun(unsigned long npages)
+{
+	unsigned i, run = 0;
+
+	for (i=0; i<coremap_npages; i++) {
+		if (coremap[i].cme_state != CME_FREE) {
+			run = 0;
+			continue;
+		}
+		run++;
+		if (run == npages) {
+			return i + 1 - npages;
+		}
+	}
+	return CM_NONE;
+}
+
+/*
+ * Take NPAGES free pages. Must be called with interrupts off. Returns
+ * CM_NONE if there is no suitable free memory. A single page comes from
+ * the zero pool if ZERO is set, and from the other end of the free list
+ * otherwise; *ZEROED says whether the page got is known to be zero.
+ */
+static
+int
+coremap_take(unsigned long npages, int zero, int *zeroed)
+{
+	unsigned long i;
+	int ix;
+
+	if (npages > nfree) {
+		return CM_NONE;
+	}
+
+	if (npages == 1) {
+		ix = zero ? freelist_tail : freelist_head;
+		*zeroed = coremap[ix].cme_zeroed;
+		assert(*zeroed || !zero || nzeroed == 0);
+	}
+	else {
+		ix = coremap_findrun(npages);
+		if (ix == CM_NONE) {
+			return CM_NONE;
+		}
+		*zeroed = 0;
+	}
+
+	for (i=0; i<npages; i++) {
+		assert(coremap[ix+i].cme_state == CME_FREE);
+		freelist_unlink(ix+i);
+		coremap[ix+i].cme_state = CME_USED;
+		coremap[ix+i].cme_npages = 0;
+	}
+	coremap[ix].cme_npages = npages;
+	coremap[ix].cme_refcount = 1;
+	coremap[ix].cme_referenced = 1;
+	coremap[ix].cme_dirty = 1;
+	coremap[ix].cme_age = 0;
+	coremap[ix].cme_seq = coremap_seq++;
+
+	return ix;
+}
+
+/*
+ * Common code for coremap_alloc and coremap_alloczero.
+ */
+static
+paddr_t
+coremap_get(unsigned long npages, int zero, int *zeroed)
+{
+	int spl, ix;
+	paddr_t pa;
+
+	assert(npages > 0);
+	*zeroed = 0;
+
+	spl = splhigh();
+
+	if (!coremap_ready) {
+		/* Early in boot; these pages can never be given back. */
+		pa = ram_stealmem(npages);
+		splx(spl);
+		return pa;
+	}
+
+	/*
+	 * If we're out of memory, take back the slab allocator's empty
+	 * slabs, then wait for the page-out daemon to make some room.
+	 * A multi-page request might still not fit afterwards, since
+	 * eviction doesn't produce contiguous runs; only retry those
+	 * once.
+	 */
+	ix = coremap_take(npages, zero, zeroed);
+	if (ix == CM_NONE && slab_reapall() > 0) {
+		ix = coremap_take(npages, zero, zeroed);
+	}
+#if !OPT_DUMBVM
+	while (ix == CM_NONE) {
+		if (swap_wait()) {
+			break;
+		}
+		ix = coremap_take(npages, zero, zeroed);
+		if (npages > 1) {
+			break;
+		}
+	}
+#endif
+	if (ix == CM_NONE) {
+		splx(spl);
+		return 0;
+	}
+
+#if !OPT_DUMBVM
+	if (nfree < PAGEOUT_LOWATER) {
+		swap_kick();
+	}
+#endif
+
+	pa = CM_PADDR(ix);
+	splx(spl);
+
+	DEBUG(DB_VM, "coremap: alloc %lu pages at 0x%x\n", npages, pa);
+	return pa;
+}
+
+paddr_t
+coremap_alloc(unsigned long npages)
+{
+	int zeroed;
+
+	return coremap_get(npages, 0, &zeroed);
+}
+
+paddr_t
+coremap_alloczero(void)
+{
+	paddr_t pa;
+	int zeroed;
+
+	pa = coremap_get(1, 1, &zeroed);
+	if (pa == 0) {
+		return 0;
+	}
+
+	if (zeroed) {
+		zero_hits++;
+	}
+	else {
+		zero_misses++;
+		bzero((void *)PADDR_TO_KVADDR(pa), PAGE_SIZE);
+	}
+	return pa;
+}
+
+void
+coremap_free(paddr_t paddr)
+{
+	int spl;
+	unsigned ix, i, npages;
+
+	assert((paddr & PAGE_FRAME) == paddr);
+
+	spl = splhigh();
+
+	if (!coremap_ready || paddr < coremap_base) {
+		/* Stolen with ram_stealmem; we can't take it back. */
+		splx(spl);
+		return;
+	}
+
+	ix = CM_INDEX(paddr);
+	assert(ix < coremap_npages);
+
+	if (coremap[ix].cme_state != CME_USED || coremap[ix].cme_npages == 0) {
+		panic("coremap: free of invalid page 0x%x\n", paddr);
+	}
+
+	assert(coremap[ix].cme_refcount > 0);
+	coremap[ix].cme_refcount--;
+	if (coremap[ix].cme_refcount > 0) {
+		/*
+		 * Still shared with someone else. We don't know which
+		 * address space is left, so nobody owns it until the
+		 * next fault on it claims it.
+		 */
+		coremap[ix].cme_as = NULL;
+		splx(spl);
+		return;
+	}
+
+#if !OPT_DUMBVM
+	if (coremap[ix].cme_slot != SWAP_NOSLOT) {
+		swap_free(coremap[ix].cme_slot);
+		coremap[ix].cme_slot = SWAP_NOSLOT;
+	}
+#endif
+
+	npages = coremap[ix].cme_npages;
+	for (i=0; i<npages; i++) {
+		assert(coremap[ix+i].cme_state == CME_USED);
+		coremap[ix+i].cme_state = CME_FREE;
+		coremap[ix+i].cme_npages = 0;
+		coremap[ix+i].cme_refcount = 0;
+		coremap[ix+i].cme_busy = 0;
+		coremap[ix+i].cme_as = NULL;
+		freelist_push(ix+i);
+	}
+
+#if !OPT_DUMBVM
+	/* A stalled page-out daemon may be able to get going again. */
+	swap_pagefreed();
+#endif
+
+	splx(spl);
+
+	DEBUG(DB_VM, "coremap: free %u pages at 0x%x\n", npages, paddr);
+}
+
+/*
+ * Look up the coremap entry for a page that is the start of an
+ * allocated block. Must be called with interrupts off.
+ */
+static
+struct coremap_entry *
+coremap_getentry(paddr_t paddr)
+{
+	unsigned ix;
+
+	assert(coremap_ready);
+	assert(paddr >= coremap_base);
+	assert((paddr & PAGE_FRAME) == paddr);
+
+	ix = CM_INDEX(paddr);
+	assert(ix < coremap_npages);
+	assert(coremap[ix].cme_state == CME_USED);
+	assert(coremap[ix].cme_npages > 0);
+
+	return &coremap[ix];
+}
+
+void
+coremap_incref(paddr_t paddr)
+{
+	struct coremap_entry *e;
+	int spl;
+
+	spl = splhigh();
+	e = coremap_getentry(paddr);
+	assert(e->cme_npages == 1);
+	assert(e->cme_refcount > 0 && e->cme_refcount < 0xffff);
+	e->cme_refcount++;
+	e->cme_as = NULL;
+	splx(spl);
+}
+
+unsigned
+coremap_refcount(paddr_t paddr)
+{
+	unsigned ret;
+	int spl;
+
+	spl = splhigh();
+	ret = coremap_getentry(paddr)->cme_refcount;
+	splx(spl);
+
+	return ret;
+}
+
+void
+coremap_setowner(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+	struct coremap_entry *e;
+	int spl;
+
+	spl = splhigh();
+	e = coremap_getentry(paddr);
+	assert(e->cme_npages == 1);
+	if (e->cme_refcount == 1) {
+		e->cme_as = as;
+		e->cme_vaddr = vaddr;
+	}
+	splx(spl);
+}
+
+int
+coremap_touch(paddr_t paddr, int write)
+{
+	struct coremap_entry *e;
+	int spl, dirty;
+
+	spl = splhigh();
+	e = coremap_getentry(paddr);
+	e->cme_referenced = 1;
+	if (write && !e->cme_dirty) {
+		/* The copy in swap is about to go stale. */
+		e->cme_dirty = 1;
+#if !OPT_DUMBVM
+		if (e->cme_slot != SWAP_NOSLOT) {
+			swap_free(e->cme_slot);
+			e->cme_slot = SWAP_NOSLOT;
+		}
+#endif
+	}
+	dirty = e->cme_dirty;
+	splx(spl);
+
+	return dirty;
+}
+
+void
+coremap_setslot(paddr_t paddr, u_int32_t slot)
+{
+	struct coremap_entry *e;
+	int spl;
+
+	spl = splhigh();
+	e = coremap_getentry(paddr);
+	assert(e->cme_slot == SWAP_NOSLOT);
+	e->cme_slot = slot;
+	e->cme_dirty = 0;
+	splx(spl);
+}
+
+#if !OPT_DUMBVM
+
+////////////////////////////////////////
+//
+// Page replacement policies.
+//
+// Each takes no arguments, is called with interrupts off, and returns
+// the coremap index of the page to evict, or CM_NONE. None of them
+// have exact reference information: cme_referenced is set whenever a
+// page is faulted into the TLB, so to find out whether a page is still
+// in use, a policy clears the bit and takes the page out of the TLB.
+
+/*
+ * Can coremap[ix] be paged out? Shared pages have no owner and can't;
+ * the file cache's pages are thrown out by vmobj_reclaim instead.
+ */
+static
+int
+cm_evictable(unsigned ix)
+{
+	struct coremap_entry *e = &coremap[ix];
+
+	return e->cme_state == CME_USED && e->cme_as != NULL &&
+		!e->cme_busy && e->cme_refcount == 1;
+}
+
+/* Clear the referenced bit, so the next use of the page faults. */
+static
+void
+cm_unreference(struct coremap_entry *e)
+{
+	e->cme_referenced = 0;
+	vm_tlbinvalidate(e->cme_as, e->cme_vaddr);
+}
+
+/*
+ * FIFO: evict the page that was allocated longest ago, whether or not
+ * it's in use.
+ */
+static
+int
+victim_fifo(void)
+{
+	unsigned i;
+	int best = CM_NONE;
+
+	for (i=0; i<coremap_npages; i++) {
+		if (!cm_evictable(i)) {
+			continue;
+		}
+		if (best == CM_NONE ||
+		    (int32_t)(coremap[i].cme_seq - coremap[best].cme_seq) < 0) {
+			best = i;
+		}
+	}
+	return best;
+}
+
+/*
+ * Clock (second chance): sweep a hand around the coremap. A page that
+ * has been used since the hand last passed gets its referenced bit
+ * cleared and is skipped; the first page that hasn't is evicted.
+ */
+static
+int
+victim_clock(void)
+{
+	static unsigned hand;
+	unsigned i, ix;
+
+	/* Two trips round: after the first, every bit is clear. */
+	for (i=0; i<2*coremap_npages; i++) {
+		ix = hand;
+		hand = (hand + 1) % coremap_npages;
+		if (!cm_evictable(ix)) {
+			continue;
+		}
+		if (coremap[ix].cme_referenced) {
+			cm_unreference(&coremap[ix]);
+			continue;
+		}
+		return ix;
+	}
+	return CM_NONE;
+}
+
+/*
+ * Aging (approximate LRU): each time we need a victim, shift every
+ * page's referenced bit into the top of its age byte. The page with
+ * the smallest age has gone unused for longest, so it's the one least
+ * likely to be in the working set; ties go to the older page.
+ */
+static
+int
+victim_aging(void)
+{
+	struct coremap_entry *e;
+	unsigned i;
+	int best = CM_NONE;
+
+	for (i=0; i<coremap_npages; i++) {
+		if (!cm_evictable(i)) {
+			continue;
+		}
+		e = &coremap[i];
+		e->cme_age >>= 1;
+		if (e->cme_referenced) {
+			e->cme_age |= 0x80;
+			cm_unreference(e);
+		}
+		if (best == CM_NONE ||
+		    e->cme_age < coremap[best].cme_age ||
+		    (e->cme_age == coremap[best].cme_age &&
+		     (int32_t)(e->cme_seq - coremap[best].cme_seq) < 0)) {
+			best = i;
+		}
+	}
+	return best;
+}
+
+static const struct {
+	const char *name;
+	int (*victim)(void);
+} policies[] = {
+	{ "fifo",	victim_fifo },
+	{ "clock",	victim_clock },
+	{ "aging",	victim_aging },
+	{ NULL, NULL },
+};
+
+/* Index into policies[] of the policy in use. */
+static int curpolicy = 1;
+
+paddr_t
+coremap_victim(struct addrspace **as, vaddr_t *vaddr, u_int32_t *slot)
+{
+	struct coremap_entry *e;
+	int ix;
+
+	assert(curspl>0);
+	assert(coremap_ready);
+
+	ix = policies[curpolicy].victim();
+	if (ix == CM_NONE) {
+		return 0;
+	}
+
+	e = &coremap[ix];
+	assert(cm_evictable(ix));
+	e->cme_busy = 1;
+	*as = e->cme_as;
+	*vaddr = e->cme_vaddr;
+
+	/*
+	 * If the page is clean, the caller can reuse its swap slot
+	 * instead of writing it out again. The slot goes with the page.
+	 */
+	if (e->cme_dirty) {
+		*slot = SWAP_NOSLOT;
+	}
+	else {
+		*slot = e->cme_slot;
+		e->cme_slot = SWAP_NOSLOT;
+	}
+
+	return CM_PADDR(ix);
+}
+
+int
+coremap_setpolicy(const char *name)
+{
+	int i, spl;
+
+	for (i=0; policies[i].name != NULL; i++) {
+		if (!strcmp(policies[i].name, name)) {
+			spl = splhigh();
+			curpolicy = i;
+			splx(spl);
+			return 0;
+		}
+	}
+	return EINVAL;
+}
+
+const char *
+coremap_getpolicy(int n)
+{
+	int i;
+
+	if (n < 0) {
+		return policies[curpolicy].name;
+	}
+	for (i=0; i<n; i++) {
+		if (policies[i].name == NULL) {
+			return NULL;
+		}
+	}
+	return policies[n].name;
+}
+
+#endif /* !OPT_DUMBVM */
+
+void
+coremap_unbusy(paddr_t paddr)
+{
+	int spl;
+
+	spl = splhigh();
+	coremap_getentry(paddr)->cme_busy = 0;
+	splx(spl);
+}
+
+/*
+ * Page-zeroing thread. Whenever the scheduler has nothing else to run,
+ * it lets this zero a few free pages for the pool.
+ */
+static
+void
+coremap_zeroer(void *unused1, unsigned long unused2)
+{
+	int spl, ix, n;
+
+	(void)unused1;
+	(void)unused2;
+
+	spl = splhigh();
+	for (;;) {
+		zero_waiting = 1;
+		thread_sleep(&zero_waiting);
+
+		for (n=0; n<ZEROPOOL_BATCH && nzeroed<ZEROPOOL_TARGET; n++) {
+			ix = freelist_head;
+			if (ix == CM_NONE || coremap[ix].cme_zeroed) {
+				/* Every free page is zero already. */
+				break;
+			}
+
+			/* Take it off the list so nobody allocates it. */
+			freelist_unlink(ix);
+			coremap[ix].cme_state = CME_ZEROING;
+			splx(spl);
+
+			bzero((void *)PADDR_TO_KVADDR(CM_PADDR(ix)), PAGE_SIZE);
+
+			spl = splhigh();
+			coremap[ix].cme_state = CME_FREE;
+			freelist_append(ix);
+		}
+	}
+}
+
+void
+coremap_zerobootstrap(void)
+{
+	int result;
+
+	result = thread_fork("pagezero", NULL, 0, coremap_zeroer, NULL);
+	if (result) {
+		panic("coremap: thread_fork failed: %s\n", strerror(result));
+	}
+}
+
+int
+coremap_idle(void)
+{
+	assert(curspl>0);
+
+	if (!zero_waiting || nzeroed >= ZEROPOOL_TARGET || nzeroed == nfree) {
+		return 0;
+	}
+
+	zero_waiting = 0;
+	thread_wakeup(&zero_waiting);
+	return 1;
+}
+
+unsigned
+coremap_freepages(void)
+{
+	return nfree;
+}
+
+void
+coremap_printstats(void)
+{
+	unsigned i, nfixed=0, nused=0, nuser=0;
+	int spl;
+
+	spl = splhigh();
+
+	if (!coremap_ready) {
+		splx(spl);
+		kprintf("coremap: not initialized yet\n");
+		return;
+	}
+
+	for (i=0; i<coremap_npages; i++) {
+		switch (coremap[i].cme_state) {
+		    case CME_FIXED: nfixed++; break;
+		    case CME_USED: nused++; break;
+		}
+		if (coremap[i].cme_as != NULL) {
+			nuser++;
+		}
+	}
+
+	splx(spl);
+
+	kprintf("coremap: %u pages at 0x%x: %u free, %u used, %u fixed\n",
+		coremap_npages, coremap_base, nfree, nused, nfixed);
+	kprintf("coremap: %u user pages can be paged out\n", nuser);
+	kprintf("coremap: %u pages pre-zeroed; %u zero-fills used the pool, "
+		"%u did not\n", nzeroed, zero_hits, zero_misses);
+}
@@ -0,0 +1,91 @@
+/*
+ * Two-level user page table. See pagetable.h.
+ */
+#include <types.h>
+#include <lib.h>
+#include <vm.h>
+#include <pagetable.h>
+
+#define PT_DIRINDEX(va)  ((va) >> PT_DIRSHIFT)
+#define PT_PTEINDEX(va)  (((va) >> 12) & (PT_NPTES - 1))
+
+struct pagetable *
+pt_create(void)
+{
+	struct pagetable *pt;
+	unsigned i;
+
+	pt = kmalloc(sizeof(struct pagetable));
+	if (pt == NULL) {
+		return NULL;
+	}
+	for (i=0; i<PT_NDIR; i++) {
+		pt->pt_dir[i] = NULL;
+	}
+	return pt;
+}
+
+void
+pt_destroy(struct pagetable *pt)
+{
+	unsigned i;
+
+	for (i=0; i<PT_NDIR; i++) {
+		if (pt->pt_dir[i] != NULL) {
+			kfree(pt->pt_dir[i]);
+		}
+	}
+	kfree(pt);
+}
+
+pte_t *
+pt_lookup(struct pagetable *pt, vaddr_t vaddr, int create)
+{
+	unsigned dirix, i;
+	pte_t *ptes;
+
+	assert(vaddr < USERTOP);
+
+	dirix = PT_DIRINDEX(vaddr);
+	ptes = pt->pt_dir[dirix];
+	if (ptes == NULL) {
+		if (!create) {
+			return NULL;
+		}
+		ptes = kmalloc(PT_NPTES * sizeof(pte_t));
+		if (ptes == NULL) {
+			return NULL;
+		}
+		for (i=0; i<PT_NPTES; i++) {
+			ptes[i] = 0;
+		}
+		pt->pt_dir[dirix] = ptes;
+	}
+	return &ptes[PT_PTEINDEX(vaddr)];
+}
+
+int
+pt_foreach(struct pagetable *pt,
+	   int (*func)(vaddr_t vaddr, pte_t *pte, void *data),
+	   void *data)
+{
+	unsigned i, j;
+	int result;
+
+	for (i=0; i<PT_NDIR; i++) {
+		if (pt->pt_dir[i] == NULL) {
+			continue;
+		}
+		for (j=0; j<PT_NPTES; j++) {
+			if (pt->pt_dir[i][j] == 0) {
+				continue;
+			}
+			result = func((i << PT_DIRSHIFT) | (j << 12),
+				      &pt->pt_dir[i][j], data);
+			if (result) {
+				return result;
+			}
+		}
+	}
+	return 0;
+}
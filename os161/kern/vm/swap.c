@@ -0,0 +1,338 @@
+/*
+ * Swap space and the page-out daemon. See swap.h.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/unistd.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <thread.h>
+#include <curthread.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <vmobj.h>
+#include <swap.h>
+#include <machine/spl.h>
+
+/* The swap device; NULL if we're running without swap. */
+static struct vnode *swap_vn;
+
+/* Which slots are in use. Protected by disabling interrupts. */
+static struct bitmap *swap_map;
+static u_int32_t swap_nslots;
+static u_int32_t swap_nused;
+
+static struct thread *pageout_thread;
+static int pageout_nwaiting;	/* threads sleeping in swap_wait */
+static int pageout_progress;	/* did the daemon's last pass free anything */
+static int pageout_stalled;	/* it didn't; wait for things to change */
+
+int
+swap_alloc(u_int32_t *slot)
+{
+	int spl, result;
+
+	if (swap_vn == NULL) {
+		return ENOSPC;
+	}
+
+	spl = splhigh();
+	result = bitmap_alloc(swap_map, slot);
+	if (result == 0) {
+		swap_nused++;
+	}
+	splx(spl);
+
+	return result;
+}
+
+void
+swap_free(u_int32_t slot)
+{
+	int spl;
+
+	assert(swap_vn != NULL);
+	assert(slot < swap_nslots);
+
+	spl = splhigh();
+	bitmap_unmark(swap_map, slot);
+	assert(swap_nused > 0);
+	swap_nused--;
+	splx(spl);
+}
+
+static
+int
+swap_io(u_int32_t slot, paddr_t paddr, enum uio_rw rw)
+{
+	struct uio u;
+	int result;
+
+	assert(swap_vn != NULL);
+	assert(slot < swap_nslots);
+
+	mk_kuio(&u, (void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE,
+		(off_t)slot * PAGE_SIZE, rw);
+
+	if (rw == UIO_READ) {
+		result = VOP_READ(swap_vn, &u);
+	}
+	else {
+		result = VOP_WRITE(swap_vn, &u);
+	}
+	if (result) {
+		return result;
+	}
+	if (u.uio_resid != 0) {
+		return EIO;
+	}
+	return 0;
+}
+
+int
+swap_read(u_int32_t slot, paddr_t paddr)
+{
+	return swap_io(slot, paddr, UIO_READ);
+}
+
+int
+swap_write(u_int32_t slot, paddr_t paddr)
+{
+	return swap_io(slot, paddr, UIO_WRITE);
+}
+
+////////////////////////////////////////
+
+/*
+ * Push one user page out to swap. Returns nonzero if there was nothing
+ * that could be evicted or no swap space left.
+ */
+static
+int
+pageout_one(void)
+{
+	struct addrspace *as;
+	vaddr_t vaddr;
+	paddr_t pa;
+	pte_t *pte;
+	u_int32_t slot;
+	int spl, result;
+
+	if (swap_vn == NULL) {
+		return ENOSPC;
+	}
+
+	spl = splhigh();
+
+	pa = coremap_victim(&as, &vaddr, &slot);
+	if (pa == 0) {
+		splx(spl);
+		return ENOMEM;
+	}
+
+	/*
+	 * Lock the page against its owner, and take it out of the TLB
+	 * so the owner can't touch it while we write it out.
+	 */
+	pte = pt_lookup(as->as_pt, vaddr, 0);
+	assert(pte != NULL);
+	assert((*pte & (PTE_VALID|PTE_BUSY)) == PTE_VALID);
+	assert(PTE_PADDR(*pte) == pa);
+	*pte |= PTE_BUSY;
+	vm_tlbinvalidate(as, vaddr);
+
+	splx(spl);
+
+	/* A clean page already has a copy in swap. */
+	result = 0;
+	if (slot == SWAP_NOSLOT) {
+		result = swap_alloc(&slot);
+		if (result == 0) {
+			DEBUG(DB_VM, "swap: page 0x%x (0x%x) -> slot %u\n",
+			      pa, vaddr, slot);
+			result = swap_write(slot, pa);
+			if (result) {
+				kprintf("swap: write to slot %u: %s\n", slot,
+					strerror(result));
+				swap_free(slot);
+			}
+			else {
+				vmstats.vs_writebacks++;
+			}
+		}
+	}
+
+	spl = splhigh();
+	if (result) {
+		*pte &= ~PTE_BUSY;
+		coremap_unbusy(pa);
+	}
+	else {
+		*pte = PTE_MKSWAP(slot);
+		coremap_free(pa);
+		vmstats.vs_evictions++;
+	}
+	thread_wakeup(pte);
+	splx(spl);
+
+	return result;
+}
+
+static
+void
+pageout_daemon(void *unused1, unsigned long unused2)
+{
+	int spl, progress;
+
+	(void)unused1;
+	(void)unused2;
+
+	spl = splhigh();
+	for (;;) {
+		while (pageout_stalled ||
+		       (coremap_freepages() >= PAGEOUT_LOWATER &&
+			pageout_nwaiting == 0)) {
+			thread_sleep(&pageout_thread);
+		}
+		splx(spl);
+
+		/* Failing swap, throw out pages of the file cache. */
+		progress = 0;
+		do {
+			if (pageout_one() && vmobj_reclaim()) {
+				break;
+			}
+			progress = 1;
+		} while (coremap_freepages() < PAGEOUT_HIWATER);
+
+		spl = splhigh();
+		pageout_progress = progress;
+		pageout_stalled = !progress;
+		thread_wakeup(&pageout_nwaiting);
+	}
+}
+
+void
+swap_printstats(void)
+{
+	if (swap_vn == NULL) {
+		kprintf("swap: none\n");
+		return;
+	}
+	kprintf("swap: %u of %u slots in use\n", swap_nused, swap_nslots);
+}
+
+void
+swap_kick(void)
+{
+	int spl;
+
+	if (pageout_thread == NULL) {
+		return;
+	}
+
+	spl = splhigh();
+	thread_wakeup(&pageout_thread);
+	splx(spl);
+}
+
+void
+swap_pagefreed(void)
+{
+	assert(curspl>0);
+
+	if (pageout_stalled) {
+		pageout_stalled = 0;
+		thread_wakeup(&pageout_thread);
+	}
+}
+
+int
+swap_wait(void)
+{
+	assert(curspl>0);
+
+	/*
+	 * The daemon itself can't wait for the daemon, and interrupt
+	 * handlers can't sleep at all.
+	 */
+	if (pageout_thread == NULL || in_interrupt ||
+	    curthread == pageout_thread) {
+		return ENOMEM;
+	}
+
+	pageout_nwaiting++;
+	pageout_stalled = 0;
+	thread_wakeup(&pageout_thread);
+	thread_sleep(&pageout_nwaiting);
+	pageout_nwaiting--;
+
+	return pageout_progress ? 0 : ENOMEM;
+}
+
+////////////////////////////////////////
+
+/*
+ * Open the swap device, if it's there.
+ */
+static
+void
+swap_open(void)
+{
+	char path[sizeof(SWAP_DEVICE)];
+	struct vnode *vn;
+	struct stat st;
+	int result;
+
+	/* vfs_open may scribble on its argument */
+	strcpy(path, SWAP_DEVICE);
+
+	result = vfs_open(path, O_RDWR, &vn);
+	if (result) {
+		kprintf("swap: %s: %s; running without swap\n",
+			SWAP_DEVICE, strerror(result));
+		return;
+	}
+
+	result = VOP_STAT(vn, &st);
+	if (result) {
+		panic("swap: stat %s: %s\n", SWAP_DEVICE, strerror(result));
+	}
+
+	swap_nslots = st.st_size / PAGE_SIZE;
+	if (swap_nslots == 0) {
+		kprintf("swap: %s is empty; running without swap\n",
+			SWAP_DEVICE);
+		vfs_close(vn);
+		return;
+	}
+
+	swap_map = bitmap_create(swap_nslots);
+	if (swap_map == NULL) {
+		panic("swap: Out of memory\n");
+	}
+	swap_vn = vn;
+
+	kprintf("swap: %s: %u pages\n", SWAP_DEVICE, swap_nslots);
+}
+
+void
+swap_bootstrap(void)
+{
+	int result;
+
+	swap_open();
+
+	/* Even without swap, the daemon can reclaim file pages. */
+	result = thread_fork("pageout", NULL, 0, pageout_daemon,
+			     &pageout_thread);
+	if (result) {
+		panic("swap: thread_fork failed: %s\n", strerror(result));
+	}
+}
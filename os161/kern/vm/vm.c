@@ -1,10 +1,16 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <elf.h>
 #include <thread.h>
 #include <curthread.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <swap.h>
+#include <vmobj.h>
+#include <kern/mman.h>
 #include <machine/spl.h>
 #include <machine/tlb.h>
 
@@ -14,46 +20,507 @@
  * used. The cheesy hack versions in dumbvm.c are used instead.
  */
 
+struct vmstats vmstats;
+
+/*
+ * Next TLB slot to refill. Reset when the TLB is flushed, so the empty
+ * slots get used up first; after that entries are replaced round-robin.
+ */
+static u_int32_t tlb_nextslot;
+
 /*
- * alloc_kpages() and free_kpages() are called by kmalloc() and thus the whole
- * kernel will not boot if these 2 functions are not completed.
+ * The address space whose translations are in the TLB. Other address
+ * spaces keep theirs in as_tlbhi/as_tlblo until they're switched back
+ * in. We don't use the MIPS address space IDs, so this is what saves
+ * refilling the whole TLB after every context switch.
  */
+static struct addrspace *tlb_as;
 
 void
 vm_bootstrap(void)
 {
-	/* do nothing */
+	coremap_bootstrap();
+	swap_bootstrap();
+	coremap_zerobootstrap();
 }
 
-vaddr_t 
+vaddr_t
 alloc_kpages(int npages)
 {
-	/*
-	 * Write this.
-	 */
-	 
-	(void)npages;
-	return 0;
+	paddr_t pa;
+
+	pa = coremap_alloc(npages);
+	if (pa==0) {
+		return 0;
+	}
+	return PADDR_TO_KVADDR(pa);
 }
 
-void 
+void
 free_kpages(vaddr_t addr)
 {
+	coremap_free(KVADDR_TO_PADDR(addr));
+}
+
+/*
+ * Invalidate the whole TLB. Interrupts must be off.
+ */
+static
+void
+tlb_clear(void)
+{
+	int i;
+
+	for (i=0; i<NUM_TLB; i++) {
+		TLB_Write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	tlb_nextslot = 0;
+}
+
+void
+vm_tlbactivate(struct addrspace *as)
+{
+	u_int32_t ehi, elo;
+	int i, n, spl;
+
+	spl = splhigh();
+
+	if (as == tlb_as) {
+		/* Nothing to do; the TLB is still valid. */
+		splx(spl);
+		return;
+	}
+
+	/* Save the outgoing address space's translations... */
+	if (tlb_as != NULL) {
+		n = 0;
+		for (i=0; i<NUM_TLB; i++) {
+			TLB_Read(&ehi, &elo, i);
+			if (elo & TLBLO_VALID) {
+				tlb_as->as_tlbhi[n] = ehi;
+				tlb_as->as_tlblo[n] = elo;
+				n++;
+			}
+		}
+		tlb_as->as_ntlb = n;
+	}
+
+	/* ...and bring back the incoming one's. */
+	tlb_clear();
+	if (as != NULL) {
+		for (i=0; i<as->as_ntlb; i++) {
+			TLB_Write(as->as_tlbhi[i], as->as_tlblo[i], i);
+		}
+		tlb_nextslot = as->as_ntlb % NUM_TLB;
+		as->as_ntlb = 0;
+	}
+	tlb_as = as;
+
+	splx(spl);
+}
+
+void
+vm_tlbforget(struct addrspace *as)
+{
+	int spl;
+
+	spl = splhigh();
+	if (as == tlb_as) {
+		tlb_clear();
+		tlb_as = NULL;
+	}
+	as->as_ntlb = 0;
+	splx(spl);
+}
+
+void
+vm_tlbflush(struct addrspace *as)
+{
+	int spl;
+
+	spl = splhigh();
+	if (as == tlb_as) {
+		tlb_clear();
+	}
+	as->as_ntlb = 0;
+	splx(spl);
+}
+
+void
+vm_tlbinvalidate(struct addrspace *as, vaddr_t vaddr)
+{
+	int i, spl;
+
+	vaddr &= PAGE_FRAME;
+
+	spl = splhigh();
+
+	if (as == tlb_as) {
+		i = TLB_Probe(vaddr, 0);
+		if (i >= 0) {
+			TLB_Write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
+	}
+	else {
+		for (i=0; i<as->as_ntlb; i++) {
+			if ((as->as_tlbhi[i] & TLBHI_VPAGE) == vaddr) {
+				/* Fill the hole with the last entry. */
+				as->as_ntlb--;
+				as->as_tlbhi[i] = as->as_tlbhi[as->as_ntlb];
+				as->as_tlblo[i] = as->as_tlblo[as->as_ntlb];
+				break;
+			}
+		}
+	}
+
+	splx(spl);
+}
+
+/*
+ * Load a translation into the TLB. If there's already an entry for
+ * VADDR (a read-only one we're upgrading) replace it; otherwise take
+ * the next slot round-robin.
+ */
+static
+void
+tlb_load(vaddr_t vaddr, paddr_t paddr, int writeable)
+{
+	u_int32_t elo;
+	int i, spl;
+
+	elo = paddr | TLBLO_VALID;
+	if (writeable) {
+		elo |= TLBLO_DIRTY;
+	}
+
+	spl = splhigh();
+
+	i = TLB_Probe(vaddr, 0);
+	if (i >= 0) {
+		TLB_Write(vaddr, elo, i);
+		splx(spl);
+		return;
+	}
+
+	TLB_Write(vaddr, elo, tlb_nextslot);
+	tlb_nextslot = (tlb_nextslot + 1) % NUM_TLB;
+
+	splx(spl);
+}
+
+/*
+ * Give the page mapped by PTE a private copy of its frame, which is
+ * shared copy-on-write with at least one other address space. The PTE
+ * is busy while we sleep, so vmobj_reclaim leaves it alone.
+ * Interrupts must be off.
+ */
+static
+int
+vm_cowbreak(pte_t *pte)
+{
+	paddr_t oldpa, newpa;
+
+	assert(curspl>0);
+
+	oldpa = PTE_PADDR(*pte);
+	*pte |= PTE_BUSY;
+
+	newpa = coremap_alloc(1);
+	if (newpa == 0) {
+		*pte &= ~PTE_BUSY;
+		thread_wakeup(pte);
+		return ENOMEM;
+	}
+
+	memmove((void *)PADDR_TO_KVADDR(newpa),
+		(const void *)PADDR_TO_KVADDR(oldpa),
+		PAGE_SIZE);
+
+	*pte = newpa | PTE_VALID;
+	thread_wakeup(pte);
+
+	/* If the other sharers went away meanwhile, this frees it. */
+	coremap_free(oldpa);
+
+	return 0;
+}
+
+/*
+ * Bring the page mapped by PTE back from swap. Interrupts must be off.
+ */
+static
+int
+vm_swapin(pte_t *pte)
+{
+	u_int32_t slot;
+	paddr_t pa;
+	int result;
+
+	assert(curspl>0);
+	assert((*pte & (PTE_SWAPPED|PTE_BUSY)) == PTE_SWAPPED);
+
+	slot = PTE_SLOT(*pte);
+	*pte |= PTE_BUSY;
+
+	pa = coremap_alloc(1);
+	if (pa == 0) {
+		result = ENOMEM;
+		goto fail;
+	}
+
+	result = swap_read(slot, pa);
+	if (result) {
+		coremap_free(pa);
+		goto fail;
+	}
+
+	/* Keep the slot; if the page stays clean we needn't write it. */
+	coremap_setslot(pa, slot);
+	*pte = pa | PTE_VALID;
+	thread_wakeup(pte);
+	return 0;
+
+ fail:
+	*pte &= ~PTE_BUSY;
+	thread_wakeup(pte);
+	return result;
+}
+
+/*
+ * Get the page at VADDR in file-backed region RG. Pages wholly from the
+ * file are shared with the file's cache. The page where the file data
+ * stops and the zero fill (the bss) starts gets a private copy, with
+ * the tail zeroed.
+ */
+static
+int
+vm_filepage(struct region *rg, vaddr_t vaddr, paddr_t *ret)
+{
+	paddr_t pa, cachepa;
+	size_t offset;
+	int result;
+
+	offset = vaddr - rg->rg_vbase;
+	assert(offset < rg->rg_filesz);
+
+	result = vmobj_getpage(rg->rg_obj, rg->rg_objoff + offset, &cachepa);
+	if (result) {
+		return result;
+	}
+
+	if (rg->rg_filesz - offset >= PAGE_SIZE) {
+		*ret = cachepa;
+		return 0;
+	}
+
+	pa = coremap_alloc(1);
+	if (pa == 0) {
+		coremap_free(cachepa);
+		return ENOMEM;
+	}
+	memmove((void *)PADDR_TO_KVADDR(pa),
+		(const void *)PADDR_TO_KVADDR(cachepa),
+		rg->rg_filesz - offset);
+	bzero((char *)PADDR_TO_KVADDR(pa) + (rg->rg_filesz - offset),
+	      PAGE_SIZE - (rg->rg_filesz - offset));
+	coremap_free(cachepa);
+
+	*ret = pa;
+	return 0;
+}
+
+/*
+ * Find or make the page for FAULTADDRESS and load it into the TLB.
+ *
+ * This runs with interrupts off, so the page-out daemon can't take
+ * the page away between our deciding what to map and mapping it. We
+ * still sleep when allocating memory or doing swap I/O; PTE_BUSY
+ * covers those.
+ */
+static
+int
+vm_pagein(struct addrspace *as, struct region *rg, int faulttype,
+	  vaddr_t faultaddress, pte_t *pte)
+{
+	paddr_t pa;
+	int result, writeable;
+
+	while (*pte & PTE_BUSY) {
+		thread_sleep(pte);
+	}
+
+	if (*pte & PTE_SWAPPED) {
+		result = vm_swapin(pte);
+		if (result) {
+			return result;
+		}
+		vmstats.vs_majfaults++;
+		DEBUG(DB_VM, "vm: 0x%x -> from swap 0x%x\n", faultaddress,
+		      PTE_PADDR(*pte));
+	}
+	else if ((*pte & PTE_VALID) == 0 && rg->rg_obj != NULL &&
+		 faultaddress - rg->rg_vbase < rg->rg_filesz) {
+		/* First touch of a file page: read it in. */
+		result = vm_filepage(rg, faultaddress, &pa);
+		if (result) {
+			return result;
+		}
+		*pte = pa | PTE_VALID;
+		vmstats.vs_minfaults++;
+		DEBUG(DB_VM, "vm: 0x%x -> file page 0x%x\n", faultaddress, pa);
+	}
+	else if ((*pte & PTE_VALID) == 0) {
+		/* First touch: give it a zero-filled page. */
+		pa = coremap_alloczero();
+		if (pa == 0) {
+			return ENOMEM;
+		}
+		*pte = pa | PTE_VALID;
+		vmstats.vs_minfaults++;
+		DEBUG(DB_VM, "vm: 0x%x -> new page 0x%x\n", faultaddress, pa);
+	}
+	else {
+		vmstats.vs_minfaults++;
+	}
+
+	/*
+	 * In a shared mapping, writes go straight to the file's page;
+	 * it's mapped read-only until then so we can tell the vmobj.
+	 */
+	if (rg->rg_mapflags == MAP_SHARED) {
+		writeable = faulttype != VM_FAULT_READ &&
+			(rg->rg_perm & PF_W) != 0;
+		if (writeable) {
+			vmobj_dirty(rg->rg_obj, rg->rg_objoff +
+				    (faultaddress - rg->rg_vbase));
+		}
+		tlb_load(faultaddress, PTE_PADDR(*pte), writeable);
+		return 0;
+	}
+
 	/*
-	 * Write this.
+	 * A page whose frame is shared, after fork or because it comes
+	 * from a file, is mapped read-only, so the first write to it
+	 * comes back here and gets a copy.
 	 */
+	if (coremap_refcount(PTE_PADDR(*pte)) > 1) {
+		if (faulttype == VM_FAULT_READ) {
+			tlb_load(faultaddress, PTE_PADDR(*pte), 0);
+			return 0;
+		}
+		result = vm_cowbreak(pte);
+		if (result) {
+			return result;
+		}
+		DEBUG(DB_VM, "vm: 0x%x -> private copy 0x%x\n",
+		      faultaddress, PTE_PADDR(*pte));
+	}
+
+	/* It's ours alone now, so it can be paged out. */
+	coremap_setowner(PTE_PADDR(*pte), as, faultaddress);
 
-	(void)addr;
+	/*
+	 * Map a clean page read-only until it's written, so that we
+	 * find out if its copy in swap goes stale.
+	 */
+	writeable = coremap_touch(PTE_PADDR(*pte),
+				  faulttype != VM_FAULT_READ);
+	if ((rg->rg_perm & PF_W) == 0 && !as->as_loading) {
+		writeable = 0;
+	}
+	tlb_load(faultaddress, PTE_PADDR(*pte), writeable);
+	return 0;
 }
 
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
+	struct addrspace *as;
+	struct region *rg;
+	pte_t *pte;
+	int spl, result;
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "vm: fault: 0x%x\n", faultaddress);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	as = curthread->t_vmspace;
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably a kernel
+		 * fault early in boot. Return EFAULT so as to panic
+		 * instead of getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	rg = as_getregion(as, faultaddress);
+	if (rg == NULL) {
+		rg = as_growstack(as, faultaddress);
+	}
+	if (rg == NULL) {
+		return EFAULT;
+	}
+
+	/* The loader may write anywhere; the program may not. */
+	if (faulttype != VM_FAULT_READ && (rg->rg_perm & PF_W) == 0 &&
+	    !as->as_loading) {
+		return EFAULT;
+	}
 	/*
-	 * Definitely write this.
+	 * Nor may it touch a region it can neither read nor execute
+	 * (PROT_NONE). Instruction fetches fault as reads, so PF_X has
+	 * to count as readable.
 	 */
+	if ((rg->rg_perm & (PF_R|PF_X)) == 0 && !as->as_loading) {
+		return EFAULT;
+	}
 
-	(void)faulttype;
-	(void)faultaddress;
-	return 0;
+	if (faulttype != VM_FAULT_READONLY) {
+		as->as_tlbmisses++;
+		vmstats.vs_tlbmisses++;
+	}
+
+	pte = pt_lookup(as->as_pt, faultaddress, 1);
+	if (pte == NULL) {
+		return ENOMEM;
+	}
+
+	spl = splhigh();
+	result = vm_pagein(as, rg, faulttype, faultaddress, pte);
+	splx(spl);
+
+	return result;
+}
+
+void
+vm_printstats(void)
+{
+	kprintf("vm: policy %s\n", coremap_getpolicy(-1));
+	kprintf("vm: %u TLB misses\n", vmstats.vs_tlbmisses);
+	kprintf("vm: %u minor faults, %u major faults\n",
+		vmstats.vs_minfaults, vmstats.vs_majfaults);
+	kprintf("vm: %u evictions, %u writebacks\n",
+		vmstats.vs_evictions, vmstats.vs_writebacks);
+	coremap_printstats();
+	swap_printstats();
+}
+
+void
+vm_resetstats(void)
+{
+	int spl;
+
+	spl = splhigh();
+	bzero(&vmstats, sizeof(vmstats));
+	splx(spl);
 }
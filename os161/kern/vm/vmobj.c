@@ -0,0 +1,761 @@
+/*
+ * Shared file pages. See vmobj.h.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <machine/spl.h>
+#include <thread.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vm.h>
+#include <addrspace.h>
+#include <pagetable.h>
+#include <coremap.h>
+#include <vmobj.h>
+#include <slab.h>
+
+/*
+ * A region of some address space that maps part of an object, so that
+ * we can find the PTEs and TLB entries for a cached page.
+ */
+struct vmobj_map {
+	struct addrspace *vm_as;
+	vaddr_t vm_vbase;
+	size_t vm_npages;
+	off_t vm_objoff;	/* file offset of vm_vbase */
+	struct vmobj_map *vm_next;
+};
+
+/*
+ * Objects and their vo_pages[] are only looked at or changed with
+ * interrupts off. Nothing is held across I/O: a page being read in or
+ * written back is marked busy instead, and anyone else who needs it
+ * sleeps on the object until it's done.
+ */
+struct vmobj {
+	struct vnode *vo_vn;
+	int vo_refcount;	/* address spaces using it */
+	int vo_dying;		/* last user gone; being written back */
+	off_t vo_size;		/* file size, when we last looked */
+	unsigned vo_npages;	/* room in vo_pages[]; covers vo_size */
+	paddr_t *vo_pages;	/* cached pages; 0 if not read yet */
+	unsigned vo_hand;	/* where vmobj_reclaim looks next */
+	struct vmobj_map *vo_maps;
+	struct vmobj *vo_next;	/* on vmobjs */
+};
+
+/*
+ * Flags kept in vo_pages[]. Page addresses are page-aligned, so the
+ * low bits are free.
+ *
+ * VO_DIRTY	may have been written through a shared mapping since it
+ *		was last written back.
+ * VO_BUSY	being read in or written back.
+ * VO_WRITING	in the range of a write() to the file; its contents are
+ *		brought up to date when the write is done.
+ */
+#define VO_DIRTY        0x1
+#define VO_BUSY         0x2
+#define VO_WRITING      0x4
+#define VO_PADDR(p)     ((p) & PAGE_FRAME)
+
+/* All objects in use. */
+static struct vmobj *vmobjs;
+
+static struct slab_cache vmobj_map_cache =
+	SLAB_CACHE("vmobj_map", sizeof(struct vmobj_map), NULL);
+
+/*
+ * Find the object for V and add a user to it, or return NULL. If it's
+ * on its way out, wait for it to go. Interrupts must be off.
+ */
+static
+struct vmobj *
+vmobj_find(struct vnode *v)
+{
+	struct vmobj *obj;
+
+	assert(curspl>0);
+
+ again:
+	for (obj = vmobjs; obj != NULL; obj = obj->vo_next) {
+		if (obj->vo_vn == v) {
+			if (obj->vo_dying) {
+				thread_sleep(obj);
+				goto again;
+			}
+			obj->vo_refcount++;
+			return obj;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Make an object for V, SIZE bytes long, with nothing cached.
+ */
+static
+struct vmobj *
+vmobj_create(struct vnode *v, off_t size)
+{
+	struct vmobj *obj;
+	unsigned i;
+
+	obj = kmalloc(sizeof(struct vmobj));
+	if (obj == NULL) {
+		return NULL;
+	}
+	obj->vo_vn = v;
+	obj->vo_refcount = 1;
+	obj->vo_dying = 0;
+	obj->vo_size = size;
+	obj->vo_npages = DIVROUNDUP(size, PAGE_SIZE);
+	obj->vo_pages = kmalloc(obj->vo_npages * sizeof(paddr_t));
+	if (obj->vo_pages == NULL) {
+		kfree(obj);
+		return NULL;
+	}
+	for (i=0; i<obj->vo_npages; i++) {
+		obj->vo_pages[i] = 0;
+	}
+	obj->vo_hand = 0;
+	obj->vo_maps = NULL;
+	obj->vo_next = NULL;
+	return obj;
+}
+
+int
+vmobj_get(struct vnode *v, struct vmobj **ret)
+{
+	struct vmobj *obj, *newobj;
+	struct stat st;
+	int spl, result;
+
+	spl = splhigh();
+	obj = vmobj_find(v);
+	splx(spl);
+	if (obj != NULL) {
+		*ret = obj;
+		return 0;
+	}
+
+	result = VOP_STAT(v, &st);
+	if (result) {
+		return result;
+	}
+	if (st.st_size == 0) {
+		/* Nothing to share. */
+		return EINVAL;
+	}
+
+	newobj = vmobj_create(v, st.st_size);
+	if (newobj == NULL) {
+		return ENOMEM;
+	}
+
+	spl = splhigh();
+	obj = vmobj_find(v);
+	if (obj == NULL) {
+		obj = newobj;
+		newobj = NULL;
+		obj->vo_next = vmobjs;
+		vmobjs = obj;
+		VOP_INCREF(v);
+	}
+	splx(spl);
+
+	if (newobj != NULL) {
+		/* Someone else made one while we slept. */
+		kfree(newobj->vo_pages);
+		kfree(newobj);
+	}
+
+	*ret = obj;
+	return 0;
+}
+
+void
+vmobj_incref(struct vmobj *obj)
+{
+	int spl;
+
+	spl = splhigh();
+	assert(obj->vo_refcount > 0);
+	obj->vo_refcount++;
+	splx(spl);
+}
+
+int
+vmobj_map(struct vmobj *obj, struct addrspace *as, const struct region *rg)
+{
+	struct vmobj_map *m;
+	int spl;
+
+	m = slab_alloc(&vmobj_map_cache);
+	if (m == NULL) {
+		return ENOMEM;
+	}
+	m->vm_as = as;
+	m->vm_vbase = rg->rg_vbase;
+	m->vm_npages = rg->rg_npages;
+	m->vm_objoff = rg->rg_objoff;
+
+	spl = splhigh();
+	m->vm_next = obj->vo_maps;
+	obj->vo_maps = m;
+	splx(spl);
+
+	return 0;
+}
+
+void
+vmobj_unmap(struct vmobj *obj, struct addrspace *as, const struct region *rg)
+{
+	struct vmobj_map *m, **pp;
+	int spl;
+
+	spl = splhigh();
+	for (pp = &obj->vo_maps; *pp != NULL; pp = &(*pp)->vm_next) {
+		m = *pp;
+		if (m->vm_as == as && m->vm_vbase == rg->rg_vbase) {
+			*pp = m->vm_next;
+			splx(spl);
+			slab_free(&vmobj_map_cache, m);
+			return;
+		}
+	}
+	splx(spl);
+}
+
+/*
+ * Hand back the address at which M maps page IX, or 0 if it doesn't.
+ */
+static
+vaddr_t
+vmobj_mapaddr(struct vmobj_map *m, unsigned ix)
+{
+	off_t offset;
+
+	offset = (off_t)ix * PAGE_SIZE;
+	if (offset < m->vm_objoff ||
+	    offset - m->vm_objoff >= (off_t)m->vm_npages * PAGE_SIZE) {
+		return 0;
+	}
+	return m->vm_vbase + (offset - m->vm_objoff);
+}
+
+/*
+ * Take away write access to page IX from every address space mapping
+ * it. PTEs don't say whether a page is writeable; that's decided when
+ * the TLB entry is loaded, so dropping the TLB entries means the next
+ * store faults and goes through vmobj_dirty. Interrupts must be off.
+ */
+static
+void
+vmobj_protect(struct vmobj *obj, unsigned ix)
+{
+	struct vmobj_map *m;
+	vaddr_t vaddr;
+
+	assert(curspl>0);
+
+	for (m = obj->vo_maps; m != NULL; m = m->vm_next) {
+		vaddr = vmobj_mapaddr(m, ix);
+		if (vaddr != 0) {
+			vm_tlbinvalidate(m->vm_as, vaddr);
+		}
+	}
+}
+
+/*
+ * Throw page IX, which must be clean and not busy, out of the cache.
+ * Every PTE mapping it is cleared, so the next touch reads it in again.
+ * Interrupts must be off.
+ */
+static
+void
+vmobj_droppage(struct vmobj *obj, unsigned ix)
+{
+	struct vmobj_map *m;
+	vaddr_t vaddr;
+	paddr_t pa;
+	pte_t *pte;
+
+	assert(curspl>0);
+
+	pa = VO_PADDR(obj->vo_pages[ix]);
+	assert(pa != 0);
+	assert((obj->vo_pages[ix] & ~PAGE_FRAME) == 0);
+
+	for (m = obj->vo_maps; m != NULL; m = m->vm_next) {
+		vaddr = vmobj_mapaddr(m, ix);
+		if (vaddr == 0) {
+			continue;
+		}
+		/*
+		 * A private copy made after a write isn't ours. A busy
+		 * PTE is being copied, and lets go of the frame itself.
+		 */
+		pte = pt_lookup(m->vm_as->as_pt, vaddr, 0);
+		if (pte == NULL || (*pte & (PTE_VALID|PTE_BUSY)) != PTE_VALID ||
+		    PTE_PADDR(*pte) != pa) {
+			continue;
+		}
+		vm_tlbinvalidate(m->vm_as, vaddr);
+		*pte = 0;
+		coremap_free(pa);
+	}
+
+	obj->vo_pages[ix] = 0;
+	coremap_free(pa);
+}
+
+/*
+ * Write page IX, which must be dirty and not busy, back to the file,
+ * but not past its end. The file may have changed size since the page
+ * was read, so look again. The page is marked clean and write-protected
+ * first, so a store made while it's being written marks it dirty
+ * again. Interrupts must be off; sleeps.
+ */
+static
+int
+vmobj_writepage(struct vmobj *obj, unsigned ix)
+{
+	struct stat st;
+	struct uio u;
+	off_t offset;
+	size_t len;
+	int result;
+
+	assert(curspl>0);
+	assert((obj->vo_pages[ix] & (VO_DIRTY|VO_BUSY)) == VO_DIRTY);
+
+	obj->vo_pages[ix] &= ~VO_DIRTY;
+	obj->vo_pages[ix] |= VO_BUSY;
+	vmobj_protect(obj, ix);
+
+	offset = (off_t)ix * PAGE_SIZE;
+	result = VOP_STAT(obj->vo_vn, &st);
+	if (result == 0 && offset < st.st_size) {
+		len = PAGE_SIZE;
+		if (st.st_size - offset < PAGE_SIZE) {
+			len = st.st_size - offset;
+		}
+		mk_kuio(&u,
+			(void *)PADDR_TO_KVADDR(VO_PADDR(obj->vo_pages[ix])),
+			len, offset, UIO_WRITE);
+		result = VOP_WRITE(obj->vo_vn, &u);
+	}
+
+	if (result) {
+		obj->vo_pages[ix] |= VO_DIRTY;
+	}
+	obj->vo_pages[ix] &= ~VO_BUSY;
+	thread_wakeup(obj);
+
+	return result;
+}
+
+/*
+ * Write back every dirty page. Interrupts must be off; sleeps.
+ */
+static
+int
+vmobj_flush(struct vmobj *obj)
+{
+	unsigned i;
+	int result;
+
+	assert(curspl>0);
+
+	for (i=0; i<obj->vo_npages; i++) {
+		while (obj->vo_pages[i] & (VO_BUSY|VO_WRITING)) {
+			thread_sleep(obj);
+		}
+		if (obj->vo_pages[i] & VO_DIRTY) {
+			result = vmobj_writepage(obj, i);
+			if (result) {
+				return result;
+			}
+		}
+	}
+	return 0;
+}
+
+int
+vmobj_sync(struct vmobj *obj)
+{
+	int spl, result;
+
+	spl = splhigh();
+	result = vmobj_flush(obj);
+	splx(spl);
+
+	return result;
+}
+
+int
+vmobj_syncvnode(struct vnode *v)
+{
+	struct vmobj *obj;
+	int spl, result;
+
+	spl = splhigh();
+	obj = vmobj_find(v);
+	splx(spl);
+	if (obj == NULL) {
+		return 0;
+	}
+
+	result = vmobj_sync(obj);
+	vmobj_release(obj);
+
+	return result;
+}
+
+void
+vmobj_release(struct vmobj *obj)
+{
+	struct vmobj **pp;
+	unsigned i;
+	int spl, result;
+
+	spl = splhigh();
+
+	assert(obj->vo_refcount > 0);
+	obj->vo_refcount--;
+	if (obj->vo_refcount > 0) {
+		splx(spl);
+		return;
+	}
+
+	assert(obj->vo_maps == NULL);
+
+	/* Keep vmobj_find from handing it out while we write it back. */
+	obj->vo_dying = 1;
+	result = vmobj_flush(obj);
+	if (result) {
+		kprintf("vmobj: writeback failed: %s\n", strerror(result));
+	}
+
+	for (pp = &vmobjs; *pp != obj; pp = &(*pp)->vo_next) {
+		assert(*pp != NULL);
+	}
+	*pp = obj->vo_next;
+	thread_wakeup(obj);
+
+	splx(spl);
+
+	for (i=0; i<obj->vo_npages; i++) {
+		assert((obj->vo_pages[i] & (VO_BUSY|VO_WRITING)) == 0);
+		if (obj->vo_pages[i] != 0) {
+			coremap_free(VO_PADDR(obj->vo_pages[i]));
+		}
+	}
+	VOP_DECREF(obj->vo_vn);
+	kfree(obj->vo_pages);
+	kfree(obj);
+}
+
+/*
+ * Make vo_pages[] cover a file of SIZE bytes. Interrupts must be off;
+ * may sleep.
+ */
+static
+int
+vmobj_grow(struct vmobj *obj, off_t size)
+{
+	paddr_t *newpages;
+	unsigned npages, i;
+
+	assert(curspl>0);
+
+	npages = DIVROUNDUP(size, PAGE_SIZE);
+	while (obj->vo_npages < npages) {
+		newpages = kmalloc(npages * sizeof(paddr_t));
+		if (newpages == NULL) {
+			return ENOMEM;
+		}
+		if (obj->vo_npages >= npages) {
+			/* Someone else grew it while kmalloc slept. */
+			kfree(newpages);
+			break;
+		}
+		for (i=0; i<obj->vo_npages; i++) {
+			newpages[i] = obj->vo_pages[i];
+		}
+		for (; i<npages; i++) {
+			newpages[i] = 0;
+		}
+		kfree(obj->vo_pages);
+		obj->vo_pages = newpages;
+		obj->vo_npages = npages;
+	}
+	if (size > obj->vo_size) {
+		obj->vo_size = size;
+	}
+	return 0;
+}
+
+/*
+ * Read one page of the file. Past end of file is zero-filled.
+ */
+static
+int
+vmobj_readpage(struct vmobj *obj, unsigned ix, paddr_t *ret)
+{
+	struct uio u;
+	paddr_t pa;
+	int result;
+
+	pa = coremap_alloc(1);
+	if (pa == 0) {
+		return ENOMEM;
+	}
+
+	mk_kuio(&u, (void *)PADDR_TO_KVADDR(pa), PAGE_SIZE,
+		(off_t)ix * PAGE_SIZE, UIO_READ);
+	result = VOP_READ(obj->vo_vn, &u);
+	if (result) {
+		coremap_free(pa);
+		return result;
+	}
+	bzero((char *)PADDR_TO_KVADDR(pa) + PAGE_SIZE - u.uio_resid,
+	      u.uio_resid);
+
+	*ret = pa;
+	return 0;
+}
+
+int
+vmobj_getpage(struct vmobj *obj, off_t offset, paddr_t *ret)
+{
+	struct stat st;
+	unsigned ix;
+	paddr_t pa;
+	int spl, result;
+
+	assert(offset % PAGE_SIZE == 0);
+
+	ix = offset / PAGE_SIZE;
+
+	spl = splhigh();
+
+	/* The file may have grown since we last looked. */
+	if (offset >= obj->vo_size) {
+		result = VOP_STAT(obj->vo_vn, &st);
+		if (result == 0 && offset >= st.st_size) {
+			result = EFAULT;
+		}
+		if (result == 0) {
+			result = vmobj_grow(obj, st.st_size);
+		}
+		if (result) {
+			splx(spl);
+			return result;
+		}
+	}
+
+	/*
+	 * A page that's busy but already has a frame is being written
+	 * back, and is fine to hand out; only wait for one being read.
+	 */
+	while (VO_PADDR(obj->vo_pages[ix]) == 0) {
+		if (obj->vo_pages[ix] & VO_BUSY) {
+			thread_sleep(obj);
+			continue;
+		}
+		obj->vo_pages[ix] = VO_BUSY;
+		result = vmobj_readpage(obj, ix, &pa);
+		obj->vo_pages[ix] = result ? 0 : pa;
+		thread_wakeup(obj);
+		if (result) {
+			splx(spl);
+			return result;
+		}
+	}
+
+	pa = VO_PADDR(obj->vo_pages[ix]);
+	coremap_incref(pa);
+	*ret = pa;
+
+	splx(spl);
+	return 0;
+}
+
+void
+vmobj_dirty(struct vmobj *obj, off_t offset)
+{
+	unsigned ix;
+	int spl;
+
+	assert(offset % PAGE_SIZE == 0);
+
+	ix = offset / PAGE_SIZE;
+	assert(ix < obj->vo_npages);
+
+	spl = splhigh();
+	assert(VO_PADDR(obj->vo_pages[ix]) != 0);
+	obj->vo_pages[ix] |= VO_DIRTY;
+	splx(spl);
+}
+
+/*
+ * Bring the cached pages from FIRST up to LAST up to date after bytes
+ * START through END of the file were written. Interrupts must be off;
+ * sleeps.
+ */
+static
+void
+vmobj_refresh(struct vmobj *obj, unsigned first, unsigned last,
+	      off_t start, off_t end)
+{
+	struct uio u;
+	off_t pgstart, from, to;
+	paddr_t pa;
+	unsigned ix;
+	int result;
+
+	assert(curspl>0);
+
+	for (ix = first; ix < last && ix < obj->vo_npages; ix++) {
+		/* A page read in meanwhile may have missed the write. */
+		while (obj->vo_pages[ix] & VO_BUSY) {
+			thread_sleep(obj);
+		}
+		pa = VO_PADDR(obj->vo_pages[ix]);
+		if (pa == 0) {
+			continue;
+		}
+
+		pgstart = (off_t)ix * PAGE_SIZE;
+		from = start > pgstart ? start : pgstart;
+		to = end < pgstart + PAGE_SIZE ? end : pgstart + PAGE_SIZE;
+		mk_kuio(&u, (char *)PADDR_TO_KVADDR(pa) + (from - pgstart),
+			to - from, from, UIO_READ);
+		result = VOP_READ(obj->vo_vn, &u);
+		if (result) {
+			kprintf("vmobj: reread failed: %s\n",
+				strerror(result));
+		}
+	}
+}
+
+int
+vmobj_write(struct vnode *v, struct uio *u)
+{
+	struct vmobj *obj;
+	off_t start;
+	unsigned ix, first, last, nmarked;
+	int spl, result;
+
+	spl = splhigh();
+	obj = vmobj_find(v);
+	if (obj == NULL) {
+		splx(spl);
+		return VOP_WRITE(v, u);
+	}
+
+	start = u->uio_offset;
+	first = start / PAGE_SIZE;
+	last = DIVROUNDUP(start + u->uio_resid, PAGE_SIZE);
+
+	/*
+	 * Keep write-back off the cached pages in the range while the
+	 * file changes under them.
+	 */
+ again:
+	for (ix = first; ix < last && ix < obj->vo_npages; ix++) {
+		if (obj->vo_pages[ix] & (VO_BUSY|VO_WRITING)) {
+			thread_sleep(obj);
+			goto again;
+		}
+	}
+	nmarked = obj->vo_npages;
+	for (ix = first; ix < last && ix < nmarked; ix++) {
+		obj->vo_pages[ix] |= VO_WRITING;
+	}
+
+	splx(spl);
+	result = VOP_WRITE(v, u);
+	spl = splhigh();
+
+	vmobj_refresh(obj, first, last, start, u->uio_offset);
+
+	for (ix = first; ix < last && ix < nmarked; ix++) {
+		obj->vo_pages[ix] &= ~VO_WRITING;
+	}
+	thread_wakeup(obj);
+
+	splx(spl);
+
+	vmobj_release(obj);
+	return result;
+}
+
+/*
+ * Find a cached page of OBJ that isn't busy, and is dirty or clean as
+ * DIRTY says. Starts where the last search left off, so every page
+ * gets a turn.
+ */
+static
+int
+vmobj_findpage(struct vmobj *obj, int dirty, unsigned *ret)
+{
+	unsigned i, ix;
+	paddr_t p;
+
+	for (i=0; i<obj->vo_npages; i++) {
+		ix = (obj->vo_hand + i) % obj->vo_npages;
+		p = obj->vo_pages[ix];
+		if (VO_PADDR(p) == 0 || (p & (VO_BUSY|VO_WRITING)) != 0) {
+			continue;
+		}
+		if (((p & VO_DIRTY) != 0) == (dirty != 0)) {
+			obj->vo_hand = ix + 1;
+			*ret = ix;
+			return 0;
+		}
+	}
+	return ENOENT;
+}
+
+int
+vmobj_reclaim(void)
+{
+	struct vmobj *obj;
+	unsigned ix;
+	int spl, result;
+
+	spl = splhigh();
+
+	/* A clean page costs nothing to drop. */
+	for (obj = vmobjs; obj != NULL; obj = obj->vo_next) {
+		if (!obj->vo_dying && vmobj_findpage(obj, 0, &ix) == 0) {
+			vmobj_droppage(obj, ix);
+			splx(spl);
+			return 0;
+		}
+	}
+
+	/* Otherwise write a dirty one back first. */
+	for (obj = vmobjs; obj != NULL; obj = obj->vo_next) {
+		if (!obj->vo_dying && vmobj_findpage(obj, 1, &ix) == 0) {
+			obj->vo_refcount++;
+			result = vmobj_writepage(obj, ix);
+			/* It may have been touched again while we slept. */
+			if (result == 0 && VO_PADDR(obj->vo_pages[ix]) != 0 &&
+			    (obj->vo_pages[ix] & ~PAGE_FRAME) == 0) {
+				vmobj_droppage(obj, ix);
+			}
+			splx(spl);
+			vmobj_release(obj);
+			return result;
+		}
+	}
+
+	splx(spl);
+	return ENOMEM;
+}
@@ -0,0 +1,250 @@
+/*
+ * fdtest - test the file table: open, close, dup2 and lseek.
+ *
+ * Checks that:
+ *   - a descriptor inherited across fork shares its seek position
+ *     with the parent's;
+ *   - so does one made with dup2;
+ *   - O_APPEND writes go to the end of the file wherever the seek
+ *     position was;
+ *   - SEEK_END seeks from the end of the file;
+ *   - the console can't seek (ESPIPE);
+ *   - opening more than OPEN_MAX files fails with EMFILE;
+ *   - reading a file opened write-only, or writing one opened
+ *     read-only, fails with EBADF.
+ *
+ * Leaves its scratch file, fdtest.dat, behind.
+ */
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <limits.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define FILENAME "fdtest.dat"
+
+static
+int
+doopen(int flags)
+{
+	int fd;
+
+	fd = open(FILENAME, flags);
+	if (fd < 0) {
+		err(1, "%s: open", FILENAME);
+	}
+	return fd;
+}
+
+static
+void
+dowrite(int fd, const char *str)
+{
+	int len = strlen(str);
+
+	if (write(fd, str, len) != len) {
+		err(1, "%s: write", FILENAME);
+	}
+}
+
+/* Return FD's seek position. */
+static
+int
+tell(int fd)
+{
+	int pos;
+
+	pos = lseek(fd, 0, SEEK_CUR);
+	if (pos < 0) {
+		err(1, "%s: lseek", FILENAME);
+	}
+	return pos;
+}
+
+/* Fail unless the last call failed with errno WANT. */
+static
+void
+musterr(int rv, int want, const char *what)
+{
+	if (rv >= 0) {
+		errx(1, "%s succeeded", what);
+	}
+	if (errno != want) {
+		err(1, "%s: expected %s", what, strerror(want));
+	}
+}
+
+static
+void
+test_fork(void)
+{
+	int fd, pid, status;
+
+	fd = doopen(O_RDWR|O_CREAT|O_TRUNC);
+	dowrite(fd, "0123456789");
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		if (tell(fd) != 10) {
+			errx(1, "child sees offset %d, should be 10", tell(fd));
+		}
+		dowrite(fd, "abcde");
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (status != 0) {
+		errx(1, "child exited with %d", status);
+	}
+	if (tell(fd) != 15) {
+		errx(1, "offset after child's write is %d, should be 15",
+		     tell(fd));
+	}
+
+	close(fd);
+	printf("fdtest: offset shared after fork: passed\n");
+}
+
+static
+void
+test_dup2(void)
+{
+	int fd, fd2;
+
+	fd = doopen(O_RDWR|O_CREAT|O_TRUNC);
+	fd2 = fd + 10;
+	if (dup2(fd, fd2) != fd2) {
+		err(1, "dup2");
+	}
+
+	dowrite(fd, "0123456789");
+	if (tell(fd2) != 10) {
+		errx(1, "dup2'd descriptor at %d, should be 10", tell(fd2));
+	}
+	if (lseek(fd2, 3, SEEK_SET) != 3) {
+		err(1, "lseek");
+	}
+	if (tell(fd) != 3) {
+		errx(1, "original descriptor at %d, should be 3", tell(fd));
+	}
+
+	/* Closing one leaves the other open. */
+	close(fd);
+	if (tell(fd2) != 3) {
+		errx(1, "offset lost when the other descriptor closed");
+	}
+	close(fd2);
+	printf("fdtest: offset shared after dup2: passed\n");
+}
+
+static
+void
+test_append(void)
+{
+	char buf[16];
+	int fd;
+
+	fd = doopen(O_WRONLY|O_CREAT|O_TRUNC);
+	dowrite(fd, "0123456789");
+	close(fd);
+
+	fd = doopen(O_RDWR|O_APPEND);
+	if (lseek(fd, 2, SEEK_SET) != 2) {
+		err(1, "lseek");
+	}
+	dowrite(fd, "abc");
+	if (tell(fd) != 13) {
+		errx(1, "offset after append is %d, should be 13", tell(fd));
+	}
+
+	/* SEEK_END counts from the end of the file. */
+	if (lseek(fd, -3, SEEK_END) != 10) {
+		err(1, "lseek SEEK_END");
+	}
+	if (read(fd, buf, sizeof(buf)) != 3) {
+		err(1, "%s: read", FILENAME);
+	}
+	buf[3] = 0;
+	if (strcmp(buf, "abc") != 0) {
+		errx(1, "read \"%s\" at the end, should be \"abc\"", buf);
+	}
+
+	close(fd);
+	printf("fdtest: O_APPEND and SEEK_END: passed\n");
+}
+
+static
+void
+test_console(void)
+{
+	musterr(lseek(STDOUT_FILENO, 0, SEEK_SET), ESPIPE,
+		"lseek on the console");
+	printf("fdtest: console can't seek: passed\n");
+}
+
+static
+void
+test_emfile(void)
+{
+	int fds[OPEN_MAX];
+	int i, n;
+
+	for (n=0; n<OPEN_MAX; n++) {
+		fds[n] = open(FILENAME, O_RDONLY);
+		if (fds[n] < 0) {
+			break;
+		}
+	}
+	if (n == OPEN_MAX) {
+		errx(1, "opened OPEN_MAX files on top of stdio");
+	}
+	musterr(fds[n], EMFILE, "opening too many files");
+	/* stdin, stdout and stderr take three. */
+	if (n != OPEN_MAX - 3) {
+		errx(1, "opened %d files, should be %d", n, OPEN_MAX - 3);
+	}
+
+	for (i=0; i<n; i++) {
+		close(fds[i]);
+	}
+	printf("fdtest: EMFILE at OPEN_MAX: passed\n");
+}
+
+static
+void
+test_accmode(void)
+{
+	char c = 'x';
+	int fd;
+
+	fd = doopen(O_WRONLY);
+	musterr(read(fd, &c, 1), EBADF, "read on a write-only file");
+	close(fd);
+
+	fd = doopen(O_RDONLY);
+	musterr(write(fd, &c, 1), EBADF, "write on a read-only file");
+	close(fd);
+
+	printf("fdtest: access modes: passed\n");
+}
+
+int
+main(void)
+{
+	test_fork();
+	test_dup2();
+	test_append();
+	test_console();
+	test_emfile();
+	test_accmode();
+	printf("fdtest: all tests passed\n");
+	return 0;
+}
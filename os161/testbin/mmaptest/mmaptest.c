@@ -0,0 +1,352 @@
+/*
+ * mmaptest - test mmap() and munmap().
+ *
+ * Checks that:
+ *   - stores through a MAP_SHARED mapping reach the file, as seen by
+ *     read(), after munmap and after fsync;
+ *   - write() to the file shows up in a MAP_SHARED mapping of it;
+ *   - stores through a MAP_PRIVATE mapping don't reach the file or
+ *     other mappings, including after fork;
+ *   - PROT_NONE mappings can't be touched and read-only ones can't be
+ *     written;
+ *   - write-only mappings, unaligned offsets and lengths too big for
+ *     the address space are refused.
+ *
+ * Leaves its scratch file, mmaptest.dat, behind.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define FILENAME "mmaptest.dat"
+#define PAGE     4096
+#define NPAGES   3
+#define FILESIZE (NPAGES * PAGE)
+
+static char buf[FILESIZE];
+
+/* The byte the file starts out with at offset I. */
+static
+char
+orig(int i)
+{
+	return 'a' + i % 26;
+}
+
+/* The byte we store through mappings at offset I. */
+static
+char
+changed(int i)
+{
+	return 'A' + i % 26;
+}
+
+static
+int
+makefile(void)
+{
+	int fd, i;
+
+	fd = open(FILENAME, O_RDWR|O_CREAT|O_TRUNC);
+	if (fd < 0) {
+		err(1, "%s: open", FILENAME);
+	}
+	for (i=0; i<FILESIZE; i++) {
+		buf[i] = orig(i);
+	}
+	if (write(fd, buf, FILESIZE) != FILESIZE) {
+		err(1, "%s: write", FILENAME);
+	}
+	return fd;
+}
+
+/* Read the whole file into buf with read(). */
+static
+void
+readfile(int fd)
+{
+	if (lseek(fd, 0, SEEK_SET) < 0) {
+		err(1, "%s: lseek", FILENAME);
+	}
+	if (read(fd, buf, FILESIZE) != FILESIZE) {
+		err(1, "%s: read", FILENAME);
+	}
+}
+
+/* libc has no memcmp. */
+static
+int
+same(const char *p, const char *q, int len)
+{
+	int i;
+
+	for (i=0; i<len; i++) {
+		if (p[i] != q[i]) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static
+void *
+domap(int prot, int flags, int fd)
+{
+	void *p;
+
+	p = mmap(NULL, FILESIZE, prot, flags, fd, 0);
+	if (p == MAP_FAILED) {
+		err(1, "mmap");
+	}
+	return p;
+}
+
+static
+void
+dounmap(void *p)
+{
+	if (munmap(p, FILESIZE) < 0) {
+		err(1, "munmap");
+	}
+}
+
+/* Check that the first LEN bytes at P are what WHICH says. */
+static
+void
+check(const char *p, int len, char (*which)(int), const char *what)
+{
+	int i;
+
+	for (i=0; i<len; i++) {
+		if (p[i] != which(i)) {
+			errx(1, "%s: byte %d is '%c', should be '%c'",
+			     what, i, p[i], which(i));
+		}
+	}
+}
+
+static
+void
+test_shared_munmap(void)
+{
+	char *p;
+	int fd, i;
+
+	fd = makefile();
+	p = domap(PROT_READ|PROT_WRITE, MAP_SHARED, fd);
+	check(p, FILESIZE, orig, "shared mapping");
+	for (i=0; i<FILESIZE; i++) {
+		p[i] = changed(i);
+	}
+	dounmap(p);
+
+	readfile(fd);
+	check(buf, FILESIZE, changed, "read() after munmap");
+	close(fd);
+	printf("mmaptest: MAP_SHARED written back by munmap: passed\n");
+}
+
+static
+void
+test_shared_fsync(void)
+{
+	char *p;
+	int fd, i;
+
+	fd = makefile();
+	p = domap(PROT_READ|PROT_WRITE, MAP_SHARED, fd);
+	for (i=0; i<FILESIZE; i++) {
+		p[i] = changed(i);
+	}
+	if (fsync(fd) < 0) {
+		err(1, "fsync");
+	}
+	readfile(fd);
+	check(buf, FILESIZE, changed, "read() after fsync");
+
+	/* Once written back, the pages must still catch later stores. */
+	p[PAGE] = '!';
+	if (fsync(fd) < 0) {
+		err(1, "fsync");
+	}
+	readfile(fd);
+	if (buf[PAGE] != '!') {
+		errx(1, "store after fsync lost");
+	}
+
+	/* And write() has to show up in the mapping. */
+	if (lseek(fd, 2*PAGE, SEEK_SET) < 0) {
+		err(1, "lseek");
+	}
+	if (write(fd, "xyz", 3) != 3) {
+		err(1, "write");
+	}
+	if (!same(p + 2*PAGE, "xyz", 3)) {
+		errx(1, "write() not seen through the mapping");
+	}
+
+	dounmap(p);
+	readfile(fd);
+	if (!same(buf + 2*PAGE, "xyz", 3)) {
+		errx(1, "write() overwritten by munmap");
+	}
+	close(fd);
+	printf("mmaptest: MAP_SHARED written back by fsync: passed\n");
+}
+
+static
+void
+test_private(void)
+{
+	char *priv, *shared;
+	int fd, i, pid, status;
+
+	fd = makefile();
+	priv = domap(PROT_READ|PROT_WRITE, MAP_PRIVATE, fd);
+	shared = domap(PROT_READ, MAP_SHARED, fd);
+
+	for (i=0; i<FILESIZE; i++) {
+		priv[i] = changed(i);
+	}
+	check(shared, FILESIZE, orig, "shared mapping beside a private one");
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		check(priv, FILESIZE, changed, "private mapping in child");
+		for (i=0; i<FILESIZE; i++) {
+			priv[i] = orig(i);
+		}
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (status != 0) {
+		errx(1, "child exited with %d", status);
+	}
+	check(priv, FILESIZE, changed, "private mapping after child wrote");
+
+	dounmap(priv);
+	dounmap(shared);
+
+	readfile(fd);
+	check(buf, FILESIZE, orig, "read() after private stores");
+	close(fd);
+	printf("mmaptest: MAP_PRIVATE copy-on-write: passed\n");
+}
+
+/*
+ * Run FUNC on P in a child, which the kernel should kill.
+ */
+static
+void
+mustfault(void (*func)(volatile char *), volatile char *p, const char *what)
+{
+	int pid, status;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		func(p);
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (status == 0) {
+		errx(1, "%s was allowed", what);
+	}
+}
+
+static
+void
+touch(volatile char *p)
+{
+	(void)*p;
+}
+
+static
+void
+scribble(volatile char *p)
+{
+	*p = '!';
+}
+
+static
+void
+test_prot(void)
+{
+	char *p;
+	int fd;
+
+	fd = makefile();
+
+	p = domap(PROT_NONE, MAP_SHARED, fd);
+	mustfault(touch, p, "reading a PROT_NONE mapping");
+	dounmap(p);
+
+	p = domap(PROT_READ, MAP_SHARED, fd);
+	mustfault(scribble, p, "writing a PROT_READ mapping");
+	dounmap(p);
+
+	if (mmap(NULL, FILESIZE, PROT_WRITE, MAP_SHARED, fd, 0) != MAP_FAILED) {
+		errx(1, "write-only mapping allowed");
+	}
+	if (errno != EINVAL) {
+		err(1, "write-only mapping: wrong error");
+	}
+
+	close(fd);
+	printf("mmaptest: protections: passed\n");
+}
+
+static
+void
+test_badargs(void)
+{
+	int fd;
+
+	fd = makefile();
+
+	if (mmap(NULL, PAGE, PROT_READ, MAP_SHARED, fd, 1) != MAP_FAILED) {
+		errx(1, "unaligned offset allowed");
+	}
+	if (errno != EINVAL) {
+		err(1, "unaligned offset: wrong error");
+	}
+
+	/* Rounding this up to a page would wrap to 0. */
+	if (mmap(NULL, 0xfffff001, PROT_READ, MAP_SHARED, fd, 0)
+	    != MAP_FAILED) {
+		errx(1, "length too big for the address space allowed");
+	}
+	if (errno != ENOMEM) {
+		err(1, "oversized length: wrong error");
+	}
+
+	close(fd);
+	printf("mmaptest: bad arguments: passed\n");
+}
+
+int
+main(void)
+{
+	test_shared_munmap();
+	test_shared_fsync();
+	test_private();
+	test_prot();
+	test_badargs();
+	printf("mmaptest: all tests passed\n");
+	return 0;
+}
@@ -15,6 +15,14 @@
  *      result expected: att
  * Test case 6:
  *      result expected: acp
+ * Test case 7 (WNOHANG while the child runs):
+ *      result expected: ncwp
+ * Test case 8 (pid -1 takes whichever child exits first):
+ *      result expected: bap
+ * Test case 9 (no children left):
+ *      result expected: eep
+ * Test case 10 (a child's child outlives it):
+ *      result expected: mrgp
  *
  * Authors:
  * Kuei Sun <kuei.sun@mail.utoronto.ca>
@@ -240,6 +248,113 @@ TEST_BEGIN(6)
         putchar('\n');             
 TEST_END()
 
+/*
+ * EINVAL is the only accepted errno when there's nothing to wait for
+ */
+static void nochild(int r)
+{
+        if (r >= 0)
+                warnx("waitpid with no children returned %d", r);
+        else if (errno != EINVAL)
+                warn("waitpid with no children");
+        else
+                putchar('e');
+}
+
+TEST_BEGIN(7, int x, r)
+        pid_c = dofork();
+        if (pid_c == 0) {
+                sleep(1);
+                putchar('c');
+                exit(3);
+        }
+
+        r = waitpid(pid_c, &x, WNOHANG);
+        if (r == 0)
+                putchar('n');
+        else
+                warnx("WNOHANG on a running child returned %d", r);
+
+        r = waitpid(pid_c, &x, 0);
+        if (r != pid_c || x != 3)
+                warnx("waitpid returned %d, exit %d", r, x);
+        else
+                putchar('w');
+
+        putchar('p');
+        putchar('\n');
+TEST_END()
+
+TEST_BEGIN(8, int x, r, pid_a, pid_b)
+        pid_a = dofork();
+        if (pid_a == 0) {
+                sleep(1);
+                exit(1);
+        }
+        pid_b = dofork();
+        if (pid_b == 0)
+                exit(2);
+
+        r = waitpid(-1, &x, 0);
+        if (r != pid_b || x != 2)
+                warnx("first waitpid(-1) got %d, exit %d", r, x);
+        else
+                putchar('b');
+
+        r = waitpid(-1, &x, 0);
+        if (r != pid_a || x != 1)
+                warnx("second waitpid(-1) got %d, exit %d", r, x);
+        else
+                putchar('a');
+
+        putchar('p');
+        putchar('\n');
+TEST_END()
+
+TEST_BEGIN(9, int x)
+        nochild(waitpid(-1, &x, 0));
+        nochild(waitpid(-1, &x, WNOHANG));
+        putchar('p');
+        putchar('\n');
+TEST_END()
+
+/*
+ * the grandchild is handed to the kernel when its parent exits, so we
+ * can't wait for it, but it still gets to run and exit
+ */
+TEST_BEGIN(10, int x, r, pid_g)
+        pid_c = dofork();
+        if (pid_c == 0) {
+                pid_g = dofork();
+                if (pid_g == 0) {
+                        sleep(1);
+                        putchar('g');
+                        exit(0);
+                }
+                putchar('m');
+                /* tell the grandparent who it was */
+                exit(pid_g);
+        }
+
+        r = waitpid(pid_c, &x, 0);
+        if (r != pid_c) {
+                warn("waitpid");
+                return;
+        }
+        pid_g = x;
+
+        if (waitpid(pid_g, &x, 0) >= 0)
+                warnx("waited for pid %d, which isn't our child", pid_g);
+        else if (errno != EINVAL)
+                warn("waitpid on a grandchild");
+        else
+                putchar('r');
+
+        sleep(2);
+        putchar('p');
+        putchar('\n');
+TEST_END()
+
 int main(void)
 {
         wait1();
@@ -248,6 +363,11 @@ int main(void)
         wait4();
         wait5();
         putchar('\n');
+        wait7();
+        wait8();
+        wait9();
+        wait10();
+        /* the parent exits in this one, so it goes last */
         wait6();
         return 0;
 }